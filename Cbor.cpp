@@ -0,0 +1,103 @@
+#include "Cbor.h"
+
+#include <cstring>
+#include <Arduino.h>
+
+#define CBOR_UNSIGNED 0
+#define CBOR_NEGATIVE 1
+#define CBOR_TEXT 3
+#define CBOR_ARRAY 4
+#define CBOR_MAP 5
+#define CBOR_SIMPLE 7
+
+CborWriter::CborWriter(uint8_t* buffer, size_t capacity) {
+  this->buffer = buffer;
+  this->capacity = capacity;
+  length = 0;
+  overflow = false;
+}
+
+void CborWriter::beginMap(uint32_t pairs) {
+  head(CBOR_MAP, pairs);
+}
+
+void CborWriter::beginArray(uint32_t items) {
+  head(CBOR_ARRAY, items);
+}
+
+void CborWriter::text(const char* value) {
+  size_t size = strlen(value);
+  head(CBOR_TEXT, size);
+  if (length + size > capacity) {
+    overflow = true;
+    return;
+  }
+  memcpy(buffer + length, value, size);
+  length += size;
+}
+
+void CborWriter::text_P(const char* value) {
+  size_t size = strlen_P(value);
+  head(CBOR_TEXT, size);
+  if (length + size > capacity) {
+    overflow = true;
+    return;
+  }
+  memcpy_P(buffer + length, value, size);
+  length += size;
+}
+
+void CborWriter::integer(int32_t value) {
+  if (value < 0) head(CBOR_NEGATIVE, (uint32_t) (-1 - value));
+  else head(CBOR_UNSIGNED, (uint32_t) value);
+}
+
+void CborWriter::number(float value) {
+  uint32_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  put((CBOR_SIMPLE << 5) | 26);
+  put(bits >> 24);
+  put(bits >> 16);
+  put(bits >> 8);
+  put(bits);
+}
+
+void CborWriter::null() {
+  put((CBOR_SIMPLE << 5) | 22);
+}
+
+size_t CborWriter::size() const {
+  return length;
+}
+
+bool CborWriter::overflowed() const {
+  return overflow;
+}
+
+void CborWriter::head(uint8_t major, uint32_t value) {
+  major <<= 5;
+  if (value < 24) {
+    put(major | value);
+  } else if (value <= 0xFF) {
+    put(major | 24);
+    put(value);
+  } else if (value <= 0xFFFF) {
+    put(major | 25);
+    put(value >> 8);
+    put(value);
+  } else {
+    put(major | 26);
+    put(value >> 24);
+    put(value >> 16);
+    put(value >> 8);
+    put(value);
+  }
+}
+
+void CborWriter::put(uint8_t value) {
+  if (length >= capacity) {
+    overflow = true;
+    return;
+  }
+  buffer[length++] = value;
+}
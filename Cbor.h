@@ -0,0 +1,30 @@
+#ifndef CBOR_H
+#define CBOR_H
+
+#include <cstddef>
+#include <cstdint>
+
+#define MIME_CBOR "application/cbor"
+
+class CborWriter {
+  public:
+    CborWriter(uint8_t* buffer, size_t capacity);
+    void beginMap(uint32_t pairs);
+    void beginArray(uint32_t items);
+    void text(const char* value);
+    void text_P(const char* value);
+    void integer(int32_t value);
+    void number(float value);
+    void null();
+    size_t size() const;
+    bool overflowed() const;
+  private:
+    void head(uint8_t major, uint32_t value);
+    void put(uint8_t value);
+    uint8_t* buffer;
+    size_t capacity;
+    size_t length;
+    bool overflow;
+};
+
+#endif
@@ -7,9 +7,49 @@
 
 //#define LOGGING
 
+// Seen by the library sources too, the sketch defines only reach its headers
+#ifdef LOGGING
+  #define ENABLE_DEBUG_PING
+#endif
+
+#define WIFI_FAST_CONNECT_TIMEOUT 2000
+#define WIFI_CONNECT_TIMEOUT 5000
+#define WIFI_RETRY_MIN_DELAY 10000
+#define WIFI_RETRY_MAX_DELAY 300000
+
 #define LOOP_DELAY 200
 #define PING_INTERVAL 60000
+#define PING_LOSS_THRESHOLD 3
 #define AUTO_UPDATE_CYCLES 60
+#define WEATHER_CONNECT_TIMEOUT 5000
+#define WEATHER_HANDSHAKE_TIMEOUT 5000
+#define WEATHER_TIMEOUT 10000
+#define WIFI_SCAN_TTL 30000
+#define SETTINGS_COMMIT_DELAY 5000
+
+// Defaults, can be overridden with "<requests per minute>,<burst>" in the rate_limit file
+#define RATE_LIMIT_PER_MINUTE 120
+#define RATE_LIMIT_BURST 20
+
+// Applies until a power mode is saved via /config
+#define POWER_MODE_DEFAULT POWER_ALWAYS_ON
+#define POWER_LISTEN_INTERVAL 3
+#define POWER_SLEEP_INTERVAL 300000
+#define POWER_SETUP_WINDOW 120000
+
+// Deep sleep uploads once this many samples are buffered or a reading moved by
+// more than the thresholds (in tenths) since the last upload
+#define SAMPLE_BUFFER_UPLOAD_LEVEL 56
+#define SAMPLE_TEMPERATURE_THRESHOLD 10
+#define SAMPLE_HUMIDITY_THRESHOLD 50
+
+// Nominal figures for the energy estimate, adjust to the actual board
+#define POWER_SUPPLY_MILLIVOLTS 3300
+#define POWER_ACTIVE_MILLIAMPS 80
+#define POWER_RADIO_OFF_MILLIAMPS 15
+#define POWER_MODEM_SLEEP_MILLIAMPS 20
+#define POWER_LIGHT_SLEEP_MILLIAMPS 3
+#define POWER_DEEP_SLEEP_MICROAMPS 20
 
 #define SAVED_OR_DEFAULT_ROOM_NAME(string) (strlen(string) == 0 ? DEFAULT_ROOM_NAME : string)
 
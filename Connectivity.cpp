@@ -1,56 +1,222 @@
 #include "Connectivity.h"
 
 #include <ESP8266WiFi.h>
-#include "Files.h"
+#include "Settings.h"
+#include "Metrics.h"
+#include "Power.h"
 #include "Logging.h"
 #include "Config.h"
 
+static ScannedNetwork scannedNetworks[WIFI_SCAN_MAX_RESULTS];
+static uint8_t scannedNetworkCount = 0;
+static uint32_t scanTime = 0;
+static bool scanValid = false;
+static bool scanRunning = false;
+
+typedef enum {
+  NETWORK_AP_ONLY,
+  NETWORK_CONNECTED,
+  NETWORK_SCANNING,
+  NETWORK_CONNECTING,
+  NETWORK_WAITING
+} network_state_t;
+
+static network_state_t networkState = NETWORK_AP_ONLY;
+static bool apRunning = false;
+static uint32_t stateSince = 0;
+static uint32_t retryDelay = WIFI_RETRY_MIN_DELAY;
+static uint32_t disconnectedAt = 0;
+static uint8_t connectingNetwork = 0;
+static uint32_t connectedIp = 0;
+
+static void onScanComplete(int count);
+
+static void logConnection() {
+  #ifdef LOGGING
+  char* logMessage = (char*) malloc(sizeof(char) * 64);
+  sprintf(logMessage, "Connected to %s", WiFi.SSID().c_str());
+  log(logMessage);
+  sprintf(logMessage, "IP address: %s", WiFi.localIP().toString().c_str());
+  log(logMessage);
+  sprintf(logMessage, "Signal strength (RSSI): %ld dBm\n", WiFi.RSSI());
+  log(logMessage);
+  free(logMessage);
+  #endif
+}
+
+static void onConnected() {
+  if (apRunning) {
+    log("Stopping access point...");
+    WiFi.softAPdisconnect(true);
+    apRunning = false;
+  }
+  if (disconnectedAt != 0) Metrics::countReconnect(millis() - disconnectedAt);
+  else Metrics::countConnected();
+  Settings::setLastNetwork(connectingNetwork, WiFi.BSSID(), WiFi.channel());
+  networkState = NETWORK_CONNECTED;
+  retryDelay = WIFI_RETRY_MIN_DELAY;
+  connectedIp = WiFi.localIP();
+  logConnection();
+}
+
+// The scan results are sorted by signal strength, so the first known network is the strongest
+static bool beginKnownNetwork() {
+  for (uint8_t i = 0; i < (scanValid ? scannedNetworkCount : 0); i++) {
+    for (uint8_t index = 0; index < SETTINGS_NETWORK_COUNT; index++) {
+      if (!Settings::hasWiFi(index) || strcmp(scannedNetworks[i].ssid, Settings::getSsid(index)) != 0) continue;
+      log("Attempting to connect...");
+      connectingNetwork = index;
+      WiFi.begin(Settings::getSsid(index), Settings::getPassword(index), scannedNetworks[i].channel, scannedNetworks[i].bssid);
+      return true;
+    }
+  }
+  log("No known network found");
+  return false;
+}
+
+static void beginConnection() {
+  log("Scanning for known networks...");
+  startWiFiScan();
+  networkState = NETWORK_SCANNING;
+  stateSince = millis();
+}
+
+static void waitForRetry() {
+  log("Failed to connect");
+  WiFi.disconnect();
+  if (!apRunning) startAP();
+  networkState = NETWORK_WAITING;
+  stateSince = millis();
+  // A device that never connected since boot is down from its first failure
+  if (disconnectedAt == 0) disconnectedAt = stateSince;
+}
+
+static bool waitForConnection(uint32_t timeout) {
+  uint32_t start = millis();
+  while (WiFi.status() != WL_CONNECTED && millis() - start < timeout) delay(10);
+  return WiFi.status() == WL_CONNECTED;
+}
+
+// DNS labels only allow letters, digits and hyphens, so any other run of
+// characters in the room name becomes a single hyphen
+void getHostname(char* hostname, size_t size) {
+  const char* roomName = Settings::getRoomName();
+  snprintf_P(hostname, size, PSTR("ESP8266-SimpleHome-%s"), SAVED_OR_DEFAULT_ROOM_NAME(roomName));
+  size_t length = 0;
+  for (size_t i = 0; hostname[i] != '\0'; i++) {
+    unsigned char c = hostname[i];
+    if (isalnum(c)) hostname[length++] = c;
+    else if (length > 0 && hostname[length - 1] != '-') hostname[length++] = '-';
+  }
+  while (length > 0 && hostname[length - 1] == '-') length--;
+  hostname[length] = '\0';
+}
+
 void configureNetwork() {
   log("Configuring network...");
-  char* ssid = readFromFile("ssid");
-  char* password = readFromFile("password");
-  wifi_set_sleep_type(NONE_SLEEP_T);
-  if (strlen(ssid) == 0 || strlen(password) == 0) {
+  Power::configureSleep();
+  if (!Settings::hasWiFi()) {
+    WiFi.mode(WIFI_AP);
     startAP();
   } else {
     log("Attempting to connect...");
-    char* roomName = readFromFile("room_name");
-    char* customHostname = (char*) malloc(sizeof(char) * 64);
-    sprintf_P(customHostname, PSTR("ESP8266-SimpleHome-%s"), SAVED_OR_DEFAULT_ROOM_NAME(roomName));
+    char customHostname[HOSTNAME_SIZE];
+    getHostname(customHostname, sizeof(customHostname));
+    WiFi.persistent(false);
+    WiFi.setAutoReconnect(false);
     WiFi.mode(WIFI_STA);
     WiFi.hostname(customHostname);
-    WiFi.begin(ssid, password);
-    free(roomName);
-    free(customHostname);
-    for (uint8_t i = 0; i < 50 && WiFi.status() != WL_CONNECTED; i++) delay(100);
-    if (WiFi.status() != WL_CONNECTED) {
-      log("Failed to connect");
-      WiFi.disconnect();
-      startAP();
-    } else {
-      #ifdef LOGGING
-      char* logMessage = (char*) malloc(sizeof(char) * 64);
-      sprintf(logMessage, "Connected to %s", WiFi.SSID());
-      log(logMessage);
-      sprintf(logMessage, "IP address: %s", WiFi.localIP().toString().c_str());
-      log(logMessage);
-      sprintf(logMessage, "Signal strength (RSSI): %ld dBm\n", WiFi.RSSI());
-      log(logMessage);
-      free(logMessage);
-      #endif
+
+    const StaticIpConfig* staticIp = Settings::getStaticIp();
+    if (staticIp->ip != 0) {
+      // Without a DNS server every lookup fails, most routers also resolve names
+      uint32_t dns = staticIp->dns != 0 ? staticIp->dns : staticIp->gateway;
+      WiFi.config(staticIp->ip, staticIp->gateway, staticIp->subnet, dns);
+    }
+
+    // Associating directly with the last access point skips the scan. Only
+    // this short attempt blocks, the scan fallback runs in updateNetwork() so
+    // the web server starts right after it.
+    bool connected = false;
+    uint8_t lastNetwork = Settings::getLastNetwork();
+    if (Settings::getChannel() != 0 && Settings::hasWiFi(lastNetwork)) {
+      log("Trying last access point...");
+      connectingNetwork = lastNetwork;
+      WiFi.begin(Settings::getSsid(lastNetwork), Settings::getPassword(lastNetwork), Settings::getChannel(), Settings::getBssid());
+      connected = waitForConnection(WIFI_FAST_CONNECT_TIMEOUT);
+      if (!connected) WiFi.disconnect();
     }
+    if (connected) onConnected();
+    else beginConnection();
+  }
+}
+
+// Returns true when the device got a new address, either by connecting or
+// because DHCP handed out a different one while connected
+bool updateNetwork() {
+  if (networkState == NETWORK_AP_ONLY) return false;
+  bool connected = WiFi.status() == WL_CONNECTED;
+  switch (networkState) {
+    case NETWORK_CONNECTED:
+      if (!connected) {
+        log("Connection lost");
+        disconnectedAt = millis();
+        beginConnection();
+        return false;
+      }
+      if ((uint32_t) WiFi.localIP() != connectedIp) {
+        connectedIp = WiFi.localIP();
+        log("IP address changed");
+        logConnection();
+        return true;
+      }
+      return false;
+    case NETWORK_SCANNING:
+      if (isWiFiScanRunning()) return false;
+      if (beginKnownNetwork()) {
+        networkState = NETWORK_CONNECTING;
+        stateSince = millis();
+      } else {
+        waitForRetry();
+      }
+      return false;
+    case NETWORK_CONNECTING:
+      if (connected) {
+        onConnected();
+        return true;
+      }
+      if (millis() - stateSince >= WIFI_CONNECT_TIMEOUT) waitForRetry();
+      return false;
+    case NETWORK_WAITING:
+      if (connected) {
+        onConnected();
+        return true;
+      }
+      if (millis() - stateSince >= retryDelay) {
+        retryDelay = retryDelay * 2 > WIFI_RETRY_MAX_DELAY ? WIFI_RETRY_MAX_DELAY : retryDelay * 2;
+        beginConnection();
+      }
+      return false;
+    default:
+      return false;
   }
-  free(ssid);
-  free(password);
+}
+
+void requestReconnect() {
+  if (networkState != NETWORK_CONNECTED) return;
+  log("Gateway unreachable, reconnecting...");
+  // Dropping the association lets updateNetwork() take the usual reconnect path
+  WiFi.disconnect();
 }
 
 void startAP() {
   log("Starting access point...");
   IPAddress apIP(192, 168, 1, 1);
   IPAddress netMsk(255, 255, 255, 0);
-  WiFi.mode(WIFI_AP);
+  WiFi.enableAP(true);
   WiFi.softAPConfig(apIP, apIP, netMsk);
   WiFi.softAP(AP_SSID, AP_PASSWORD);
+  apRunning = true;
 }
 
 uint8_t RSSIToPercent(long rssi) {
@@ -58,3 +224,64 @@ uint8_t RSSIToPercent(long rssi) {
   else if (rssi <= -100) return 0;
   else return (rssi + 100) * 2;
 }
+
+static void onScanComplete(int count) {
+  scannedNetworkCount = 0;
+  for (int i = 0; i < count; i++) {
+    bss_info* info = reinterpret_cast<bss_info*>(WiFi.getScanInfoByIndex(i));
+    if (info == nullptr || info->ssid_len == 0) continue;
+    uint8_t length = info->ssid_len > 32 ? 32 : info->ssid_len;
+
+    ScannedNetwork* network = nullptr;
+    for (uint8_t j = 0; j < scannedNetworkCount; j++) {
+      if (strlen(scannedNetworks[j].ssid) == length && memcmp(scannedNetworks[j].ssid, info->ssid, length) == 0) {
+        network = &scannedNetworks[j];
+        break;
+      }
+    }
+    if (network != nullptr && network->rssi >= info->rssi) continue;
+    if (network == nullptr) {
+      if (scannedNetworkCount < WIFI_SCAN_MAX_RESULTS) {
+        network = &scannedNetworks[scannedNetworkCount++];
+      } else {
+        network = &scannedNetworks[WIFI_SCAN_MAX_RESULTS - 1];
+        if (network->rssi >= info->rssi) continue;
+      }
+    }
+    memcpy(network->ssid, info->ssid, length);
+    network->ssid[length] = '\0';
+    network->rssi = info->rssi;
+    network->channel = info->channel;
+    network->authMode = info->authmode;
+    memcpy(network->bssid, info->bssid, sizeof(network->bssid));
+
+    // Keep the table sorted by signal strength, strongest first
+    while (network > scannedNetworks && (network - 1)->rssi < network->rssi) {
+      ScannedNetwork swap = *(network - 1);
+      *(network - 1) = *network;
+      *network = swap;
+      network--;
+    }
+  }
+  WiFi.scanDelete();
+  scanTime = millis();
+  scanValid = count >= 0;
+  scanRunning = false;
+  log("WiFi scan completed");
+}
+
+void startWiFiScan() {
+  if (scanRunning) return;
+  if (scanValid && millis() - scanTime < WIFI_SCAN_TTL) return;
+  scanRunning = true;
+  WiFi.scanNetworksAsync(onScanComplete);
+}
+
+bool isWiFiScanRunning() {
+  return scanRunning;
+}
+
+uint8_t getScannedNetworks(const ScannedNetwork** networks) {
+  *networks = scannedNetworks;
+  return scanValid ? scannedNetworkCount : 0;
+}
@@ -1,10 +1,28 @@
 #ifndef CONNECTIVITY_H
 #define CONNECTIVITY_H
 
+#include <cstddef>
 #include <cstdint>
 
+#define WIFI_SCAN_MAX_RESULTS 16
+#define HOSTNAME_SIZE 64
+
+struct ScannedNetwork {
+  char ssid[33];
+  int8_t rssi;
+  uint8_t channel;
+  uint8_t authMode;
+  uint8_t bssid[6];
+};
+
+void getHostname(char* hostname, size_t size);
 void configureNetwork();
 void startAP();
+bool updateNetwork();
+void requestReconnect();
 uint8_t RSSIToPercent(long rssi);
+void startWiFiScan();
+bool isWiFiScanRunning();
+uint8_t getScannedNetworks(const ScannedNetwork** networks);
 
 #endif
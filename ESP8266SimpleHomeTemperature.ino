@@ -2,7 +2,6 @@
 
 #ifdef LOGGING
   #define DEBUG_ESP_HTTP_SERVER
-  #define ENABLE_DEBUG_PING
   #define DHT_DEBUG
 #endif
 
@@ -10,13 +9,20 @@
 #include <ESP8266WiFi.h>
 #include "src/Mod_ESP8266Ping.h"
 #include <ESP8266WebServer.h>
-#include "src/Mod_ESP8266HTTPClient.h"
 #include "src/Mod_ESP8266SSDP.h"
 #include <LittleFS.h>
 #include "src/Mod_DHT.h"
 #include "Connectivity.h"
 #include "Routes.h"
-#include "Files.h"
+#include "Metrics.h"
+#include "Cbor.h"
+#include "RateLimiter.h"
+#include "Settings.h"
+#include "Power.h"
+#include "Upload.h"
+#include "SampleBuffer.h"
+#include "Mdns.h"
+#include "Weather.h"
 #include "Logging.h"
 
 ESP8266WebServer server(80);
@@ -26,7 +32,7 @@ unsigned int cycle = 0;
 uint8_t updateCycle = 0;
 float temperature = 0;
 float humidity = 0;
-char* weather;
+bool sampleBuffered = false;
 
 void setup() {
   pinMode(LED_BUILTIN, OUTPUT);
@@ -36,58 +42,79 @@ void setup() {
   Serial.begin(9600);
   #endif
   LittleFS.begin();
+  Settings::begin();
+  Power::begin();
+  SampleBuffer::begin();
   dht.begin();
 
-  delay(1000);
+  //Deep sleep wakes only buffer the sample unless an upload is due
+  if (Power::shouldSleep()) {
+    if (Power::isRadioRestart()) sampleBuffered = true;
+    else bufferSample();
+    bool uploadEnabled = strlen(Settings::getUploadUrl()) > 0;
+    if (!uploadEnabled || !SampleBuffer::isUploadDue()) Power::sleep(uploadEnabled && SampleBuffer::isUploadDueNextWake());
+    if (!Power::isRadioOn()) Power::wakeRadio();
+  }
 
   //Configuring AP
   configureNetwork();
 
   //Add routes
   Routes routes(&server);
-  server.on(F("/"), HTTP_GET, std::bind(&Routes::handleRoot, routes));
-  server.on(F("/wifi"), HTTP_GET, std::bind(&Routes::handleWiFi, routes));
-  server.on(F("/wifi-script"), HTTP_GET, std::bind(&Routes::handleWiFiScript, routes));
-  server.on(F("/wifi-result"), HTTP_GET, std::bind(&Routes::handleWiFiResult, routes));
-  server.on(F("/wifi-save"), HTTP_ANY, std::bind(&Routes::handleWiFiSave, routes));
-  server.on(F("/room-name"), HTTP_GET, std::bind(&Routes::handleRoomName, routes));
-  server.on(F("/room-name-save"), HTTP_ANY, std::bind(&Routes::handleRoomNameSave, routes));
-  server.on(F("/weather"), HTTP_GET, std::bind(&Routes::handleWeather, routes));
-  server.on(F("/weather-save"), HTTP_ANY, std::bind(&Routes::handleWeatherSave, routes));
-  server.on(F("/request-restart"), HTTP_GET, std::bind(&Routes::handleRequestRestart, routes));
-  server.on(F("/status"), HTTP_GET, std::bind(&Routes::handleStatus, routes));
-  server.on(F("/commands"), HTTP_GET, handleCommands);
-  server.on(F("/temperature"), HTTP_GET, std::bind(&Routes::handleCommand, routes));
-  server.on(F("/humidity"), HTTP_GET, std::bind(&Routes::handleCommand, routes));
-  server.on(F("/css"), HTTP_GET, std::bind(&Routes::handleCss, routes));
-  server.on(F("/description.xml"), HTTP_GET, []() {
-    WiFiClient client = server.client();
-    SSDP.schema(client);
-    client.stop();
-  });
-  server.onNotFound(std::bind(&Routes::handleNotFound, routes));
+  addRoute(F("/"), HTTP_GET, std::bind(&Routes::handleRoot, routes));
+  addRoute(F("/wifi"), HTTP_GET, std::bind(&Routes::handleWiFi, routes));
+  addRoute(F("/wifi-script"), HTTP_GET, std::bind(&Routes::handleWiFiScript, routes));
+  addRoute(F("/wifi-result"), HTTP_GET, std::bind(&Routes::handleWiFiResult, routes));
+  addRoute(F("/wifi-save"), HTTP_ANY, std::bind(&Routes::handleWiFiSave, routes));
+  addRoute(F("/room-name"), HTTP_GET, std::bind(&Routes::handleRoomName, routes));
+  addRoute(F("/room-name-save"), HTTP_ANY, std::bind(&Routes::handleRoomNameSave, routes));
+  addRoute(F("/weather"), HTTP_GET, std::bind(&Routes::handleWeather, routes));
+  addRoute(F("/weather-save"), HTTP_ANY, std::bind(&Routes::handleWeatherSave, routes));
+  addRoute(F("/config"), HTTP_GET, std::bind(&Routes::handleConfig, routes));
+  addRoute(F("/config"), HTTP_POST, std::bind(&Routes::handleConfigSave, routes));
+  addRoute(F("/request-restart"), HTTP_GET, std::bind(&Routes::handleRequestRestart, routes));
+  addRoute(F("/status"), HTTP_GET, std::bind(&Routes::handleStatus, routes));
+  addRoute(F("/metrics"), HTTP_GET, std::bind(&Routes::handleMetrics, routes));
+  addRoute(F("/debug/routes"), HTTP_GET, std::bind(&Routes::handleDebugRoutes, routes));
+  addRoute(F("/debug/routes-reset"), HTTP_POST, std::bind(&Routes::handleDebugRoutesReset, routes));
+  addRoute(F("/commands"), HTTP_GET, handleCommands);
+  addRoute(F("/commands.cbor"), HTTP_GET, handleCommandsCbor);
+  addRoute(F("/temperature"), HTTP_GET, std::bind(&Routes::handleCommand, routes));
+  addRoute(F("/humidity"), HTTP_GET, std::bind(&Routes::handleCommand, routes));
+  addRoute(F("/css"), HTTP_GET, std::bind(&Routes::handleCss, routes));
+  addRoute(F("/description.xml"), HTTP_GET, handleDescription);
+  server.onNotFound(Metrics::track(F("*"), HTTP_ANY, std::bind(&Routes::handleNotFound, routes)));
+  const char* headerKeys[] = { "Accept", "If-None-Match" };
+  server.collectHeaders(headerKeys, sizeof(headerKeys) / sizeof(headerKeys[0]));
+  RateLimiter::begin(&server);
   server.begin();
 
   //Service Discovery
-  strcpy_P(SSDP.schemaURL, PSTR("description.xml"));
+  SSDP.schemaURL = PSTR("description.xml");
   SSDP.port = 80;
   strcpy_P(SSDP.friendlyName, PSTR("Thermometer"));
-  strcpy_P(SSDP.presentationURL, PSTR("status"));
-  strcpy_P(SSDP.modelName, PSTR("SimpleHome"));
-  strcpy_P(SSDP.modelNumber, PSTR("0"));
-  strcpy_P(SSDP.modelURL, PSTR("https://github.com/Domi04151309/HomeApp"));
-  strcpy_P(SSDP.deviceType, PSTR("upnp:rootdevice"));
+  SSDP.presentationURL = PSTR("status");
+  SSDP.modelName = PSTR("SimpleHome");
+  SSDP.modelNumber = PSTR("0");
+  SSDP.modelURL = PSTR("https://github.com/Domi04151309/HomeApp");
+  SSDP.deviceType = PSTR("upnp:rootdevice");
   SSDP.begin();
-
-  //Weather service
-  weather = (char*) malloc(sizeof(char) * 64);
-  strcpy_P(weather, PSTR("Unknown"));
+  Mdns::begin();
 
   digitalWrite(LED_BUILTIN, 1);
 }
 
 void loop() {
+  uint32_t loopStart = millis();
   server.handleClient();
+  Settings::loop();
+  if (updateNetwork()) {
+    SSDP.begin();
+    Mdns::begin();
+  }
+  Mdns::loop();
+  Weather::loop();
+  if (Power::shouldSleep()) sampleAndSleep();
 
   if ((cycle * LOOP_DELAY) / PING_INTERVAL >= 1) {
     cycle = 0;
@@ -95,23 +122,11 @@ void loop() {
     if (updateCycle > AUTO_UPDATE_CYCLES) {
       updateCycle = 0;
       updateSensorData();
-      char* weatherDisplay = readFromFile("weather");
-      if (strcmp(weatherDisplay, "1") == 0) {
-        HTTPClient http;
-        WiFiClientSecure client;
-        client.setInsecure(); 
-        http.begin(client, "wttr.in", 443, "/?T&format=%t+in+%l", true);
-        if (http.GET() == 200) strcpy(weather, http.getString().c_str());
-        else log(http.getString().c_str());
-        http.end();
-      } else {
-        Ping.ping(WiFi.gatewayIP());
-      }
-      free(weatherDisplay);
-    } else {
-      Ping.ping(WiFi.gatewayIP());
+      if (Settings::isWeatherEnabled()) Weather::update();
     }
+    pingGateway();
     updateCycle++;
+    Metrics::sampleHeap();
 
     #ifdef LOGGING
     char* logMessage = (char*) malloc(sizeof(char) * 64);
@@ -126,24 +141,121 @@ void loop() {
   }
   cycle++;
 
+  Metrics::countLoop(millis() - loopStart);
   delay(LOOP_DELAY);
 }
 
-void updateSensorData() {
+void addRoute(const __FlashStringHelper* uri, HTTPMethod method, ESP8266WebServer::THandlerFunction handler) {
+  server.on(uri, method, Metrics::track(uri, method, handler));
+}
+
+void pingGateway() {
+  // React once when the streak of lost replies reaches the threshold, gateways that never reply are not reconnected to over and over
+  static uint32_t checkedPings = 0;
+  if (Ping.completed() != checkedPings) {
+    checkedPings = Ping.completed();
+    if (Ping.consecutiveLost() == PING_LOSS_THRESHOLD) requestReconnect();
+  }
+  if (WiFi.status() == WL_CONNECTED) Ping.start(WiFi.gatewayIP());
+}
+
+// After a deep sleep wake the globals hold no earlier reading, so a failed
+// read is buffered as missing rather than as their stale or zero value
+void bufferSample() {
+  if (updateSensorData()) SampleBuffer::add(temperature, humidity);
+  else SampleBuffer::add(NAN, NAN);
+  sampleBuffered = true;
+}
+
+// Ends a deep sleep cycle: push the buffered samples and sleep until the next wake
+void sampleAndSleep() {
+  if (!sampleBuffered) bufferSample();
+  const char* uploadUrl = Settings::getUploadUrl();
+  bool uploadEnabled = strlen(uploadUrl) > 0;
+  if (uploadEnabled && WiFi.status() == WL_CONNECTED && uploadSamples(uploadUrl)) SampleBuffer::clear();
+  Power::sleep(uploadEnabled && SampleBuffer::isUploadDueNextWake());
+}
+
+// Samples are sent oldest first as [temperature, humidity] pairs in tenths,
+// boot numbers the wake of the first one and interval spaces them in seconds.
+// A value that could not be read is sent as null.
+bool uploadSamples(const char* uploadUrl) {
+  const char* roomName = Settings::getRoomName();
+  uint8_t buffer[96 + SAMPLE_BUFFER_CAPACITY * 7];
+  CborWriter cbor(buffer, sizeof(buffer));
+  cbor.beginMap(6);
+  cbor.text_P(PSTR("room"));
+  cbor.text(SAVED_OR_DEFAULT_ROOM_NAME(roomName));
+  cbor.text_P(PSTR("boot"));
+  cbor.integer(SampleBuffer::getFirstBoot());
+  cbor.text_P(PSTR("interval"));
+  cbor.integer(POWER_SLEEP_INTERVAL / 1000);
+  cbor.text_P(PSTR("samples"));
+  cbor.beginArray(SampleBuffer::getCount());
+  for (uint16_t i = 0; i < SampleBuffer::getCount(); i++) {
+    const Sample* sample = SampleBuffer::getSample(i);
+    cbor.beginArray(2);
+    if (sample->temperature != SAMPLE_INVALID_TEMPERATURE) cbor.integer(sample->temperature);
+    else cbor.null();
+    if (sample->humidity != SAMPLE_INVALID_HUMIDITY) cbor.integer(sample->humidity);
+    else cbor.null();
+  }
+  cbor.text_P(PSTR("awake"));
+  cbor.integer(Power::getLastAwakeTime());
+  cbor.text_P(PSTR("energy"));
+  cbor.integer(Power::getSampleEnergy());
+  if (cbor.overflowed()) return false;
+  return upload(uploadUrl, buffer, cbor.size(), MIME_CBOR);
+}
+
+void handleDescription() {
+  size_t length;
+  uint32_t etag;
+  const char* document = SSDP.schemaDocument(&length, &etag);
+  server.keepAlive(false);
+  if (!document) {
+    server.send(500);
+    return;
+  }
+  char etagValue[11];
+  sprintf_P(etagValue, PSTR("\"%08x\""), etag);
+  server.sendHeader(F("ETag"), etagValue);
+  server.sendHeader(F("Access-Control-Allow-Origin"), F("*"));
+  if (server.header("If-None-Match") == etagValue) {
+    server.send(304);
+    return;
+  }
+  server.send(200, "text/xml", document, length);
+  Metrics::countBytesSent(length);
+}
+
+// Returns true when both values were read, a failed read keeps the previous value
+bool updateSensorData() {
   float event;
   
   event = dht.readTemperature();
-  if (!isnan(event)) temperature = event;
+  bool temperatureRead = !isnan(event);
+  if (temperatureRead) temperature = event;
 
   event = dht.readHumidity();
-  if (!isnan(event)) humidity = event;
+  bool humidityRead = !isnan(event);
+  if (humidityRead) humidity = event;
+
+  Metrics::countSensorRead(temperatureRead, humidityRead);
+  return temperatureRead && humidityRead;
 }
 
 void handleCommands() {
+  // The body depends on Accept, caches must not hand CBOR to JSON clients
+  server.sendHeader(F("Vary"), F("Accept"));
+  if (server.header(F("Accept")).indexOf(F(MIME_CBOR)) >= 0) {
+    handleCommandsCbor();
+    return;
+  }
+
   updateSensorData();
 
-  char* roomName = readFromFile("room_name");
-  char* weatherDisplay = readFromFile("weather");
+  const char* roomName = Settings::getRoomName();
   char* message = (char*) malloc(sizeof(char) * 512);
   sprintf_P(
     message,
@@ -156,24 +268,49 @@ void handleCommands() {
     temperature,
     SAVED_OR_DEFAULT_ROOM_NAME(roomName),
     humidity,
-    SAVED_OR_DEFAULT_ROOM_NAME(roomName),
-    weather
+    SAVED_OR_DEFAULT_ROOM_NAME(roomName)
   );
-  if (strcmp(weatherDisplay, "1") == 0) {
+  if (Settings::isWeatherEnabled()) {
     sprintf_P(
       message + strlen(message),
       PSTR(
         ","
         "\"weather\":{\"icon\": \"gauge\",\"title\":\"Weather\",\"summary\":\"%s\", \"mode\": \"none\"}"
       ),
-      weather
+      Weather::get()
     );
   }
   strcat_P(message, PSTR("}}"));
 
   server.keepAlive(false);
   server.send(200, F("application/json"), message);
-  free(roomName);
-  free(weatherDisplay);
+  Metrics::countBytesSent(strlen(message));
   free(message);
 }
+
+void handleCommandsCbor() {
+  updateSensorData();
+
+  const char* roomName = Settings::getRoomName();
+  bool weatherEnabled = Settings::isWeatherEnabled();
+  uint8_t buffer[160];
+  CborWriter cbor(buffer, sizeof(buffer));
+  cbor.beginMap(weatherEnabled ? 4 : 3);
+  cbor.text_P(PSTR("room"));
+  cbor.text(SAVED_OR_DEFAULT_ROOM_NAME(roomName));
+  cbor.text_P(PSTR("temperature"));
+  cbor.number(temperature);
+  cbor.text_P(PSTR("humidity"));
+  cbor.number(humidity);
+  if (weatherEnabled) {
+    cbor.text_P(PSTR("weather"));
+    cbor.text(Weather::get());
+  }
+  server.keepAlive(false);
+  if (cbor.overflowed()) {
+    server.send(500);
+    return;
+  }
+  server.send(200, MIME_CBOR, (const char*) buffer, cbor.size());
+  Metrics::countBytesSent(cbor.size());
+}
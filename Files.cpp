@@ -2,27 +2,32 @@
 
 #include <LittleFS.h>
 
-char* readFromFile(const char* filename) {
+size_t readFromFile(const char* filename, char* buffer, size_t size) {
+  buffer[0] = '\0';
   File file = LittleFS.open(filename, "r");
-  if (!file) {
-    char* result = (char*) malloc(sizeof(char));
-    result[0] = '\0';
-    return result;
-  }
-  char* result = (char*) malloc(file.size() + sizeof(char));
-  int i;
-  for (i = 0; file.available(); i++) {
-      result[i] = (char) file.read();
-  }
-  result[i] = '\0';
+  if (!file) return 0;
+  size_t length = file.read((uint8_t*) buffer, size - 1);
+  buffer[length] = '\0';
   file.close();
-  return result;
+  return length;
 }
 
-bool writeToFile(const char* filename, char content[]) {  
+size_t readBinaryFile(const char* filename, void* buffer, size_t size) {
+  File file = LittleFS.open(filename, "r");
+  if (!file) return 0;
+  size_t length = file.read((uint8_t*) buffer, size);
+  file.close();
+  return length;
+}
+
+bool writeBinaryFile(const char* filename, const void* buffer, size_t size) {
   File file = LittleFS.open(filename, "w");
   if (!file) return false;
-  if (file.print(content) == 0) return false;
+  size_t length = file.write((const uint8_t*) buffer, size);
   file.close();
-  return true;
+  return length == size;
+}
+
+bool removeFile(const char* filename) {
+  return LittleFS.remove(filename);
 }
@@ -1,7 +1,11 @@
 #ifndef FILES_H
 #define FILES_H
 
-char* readFromFile(const char* filename);
-bool writeToFile(const char* filename, char content[]);
+#include <cstddef>
+
+size_t readFromFile(const char* filename, char* buffer, size_t size);
+size_t readBinaryFile(const char* filename, void* buffer, size_t size);
+bool writeBinaryFile(const char* filename, const void* buffer, size_t size);
+bool removeFile(const char* filename);
 
 #endif
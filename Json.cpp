@@ -0,0 +1,157 @@
+#include "Json.h"
+
+#include <cctype>
+#include <cstring>
+#include <cstdlib>
+
+#define JSON_MAX_DEPTH 16
+
+JsonReader::JsonReader(const char* json) {
+  position = json;
+  first = 0;
+  depth = 0;
+  error = false;
+}
+
+bool JsonReader::beginObject() {
+  return begin('{');
+}
+
+bool JsonReader::beginArray() {
+  return begin('[');
+}
+
+bool JsonReader::nextKey(char* key, size_t size) {
+  if (!next('}')) return false;
+  if (!readString(key, size)) return false;
+  skipWhitespace();
+  if (*position != ':') return fail();
+  position++;
+  return true;
+}
+
+bool JsonReader::nextItem() {
+  return next(']');
+}
+
+bool JsonReader::readString(char* value, size_t size) {
+  if (error) return false;
+  skipWhitespace();
+  if (*position != '"') return fail();
+  position++;
+  size_t length = 0;
+  while (*position != '"') {
+    // The reader never moves past the terminator, not even after a backslash
+    uint32_t c = (uint8_t) *position;
+    bool codePoint = false;
+    if (c < 0x20) return fail();
+    position++;
+    if (c == '\\') {
+      char escape = *position;
+      if (escape == '\0') return fail();
+      position++;
+      switch (escape) {
+        case '"': c = '"'; break;
+        case '\\': c = '\\'; break;
+        case '/': c = '/'; break;
+        case 'b': c = '\b'; break;
+        case 'f': c = '\f'; break;
+        case 'n': c = '\n'; break;
+        case 'r': c = '\r'; break;
+        case 't': c = '\t'; break;
+        case 'u': {
+          char hex[5];
+          for (uint8_t i = 0; i < 4; i++) {
+            if (!isxdigit((uint8_t) position[i])) return fail();
+            hex[i] = position[i];
+          }
+          hex[4] = '\0';
+          position += 4;
+          c = strtoul(hex, nullptr, 16);
+          if (c == 0) return fail();
+          codePoint = true;
+          break;
+        }
+        default: return fail();
+      }
+    }
+    // Escaped code points are stored as UTF-8, raw bytes are copied as they are
+    uint8_t bytes = !codePoint || c < 0x80 ? 1 : c < 0x800 ? 2 : 3;
+    if (length + bytes >= size) return fail();
+    if (bytes == 1) {
+      value[length++] = c;
+    } else if (bytes == 2) {
+      value[length++] = 0xC0 | (c >> 6);
+      value[length++] = 0x80 | (c & 0x3F);
+    } else {
+      value[length++] = 0xE0 | (c >> 12);
+      value[length++] = 0x80 | ((c >> 6) & 0x3F);
+      value[length++] = 0x80 | (c & 0x3F);
+    }
+  }
+  position++;
+  value[length] = '\0';
+  return true;
+}
+
+bool JsonReader::readBool(bool* value) {
+  if (error) return false;
+  skipWhitespace();
+  if (strncmp(position, "true", 4) == 0) {
+    *value = true;
+    position += 4;
+  } else if (strncmp(position, "false", 5) == 0) {
+    *value = false;
+    position += 5;
+  } else {
+    return fail();
+  }
+  return true;
+}
+
+bool JsonReader::end() {
+  if (error) return false;
+  skipWhitespace();
+  return !error && depth == 0 && *position == '\0';
+}
+
+bool JsonReader::failed() const {
+  return error;
+}
+
+bool JsonReader::fail() {
+  error = true;
+  return false;
+}
+
+bool JsonReader::begin(char c) {
+  if (error) return false;
+  skipWhitespace();
+  if (*position != c || depth >= JSON_MAX_DEPTH) return fail();
+  position++;
+  first |= 1 << depth;
+  depth++;
+  return true;
+}
+
+bool JsonReader::next(char close) {
+  if (error || depth == 0) return fail();
+  skipWhitespace();
+  uint16_t mask = 1 << (depth - 1);
+  if (*position == close) {
+    position++;
+    depth--;
+    return false;
+  }
+  if (first & mask) {
+    first &= ~mask;
+  } else {
+    if (*position != ',') return fail();
+    position++;
+  }
+  return true;
+}
+
+void JsonReader::skipWhitespace() {
+  while (*position == ' ' || *position == '\t' || *position == '\n' || *position == '\r') position++;
+}
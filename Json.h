@@ -0,0 +1,30 @@
+#ifndef JSON_H
+#define JSON_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Minimal pull reader for the small documents accepted by the web interface
+class JsonReader {
+  public:
+    JsonReader(const char* json);
+    bool beginObject();
+    bool beginArray();
+    bool nextKey(char* key, size_t size);
+    bool nextItem();
+    bool readString(char* value, size_t size);
+    bool readBool(bool* value);
+    bool end();
+    bool failed() const;
+  private:
+    bool fail();
+    bool begin(char c);
+    bool next(char close);
+    void skipWhitespace();
+    const char* position;
+    uint16_t first;
+    uint8_t depth;
+    bool error;
+};
+
+#endif
@@ -0,0 +1,250 @@
+#include "Mdns.h"
+
+#include <Arduino.h>
+#include <ESP8266WiFi.h>
+#include "Logging.h"
+#include "Config.h"
+
+#define MDNS_MULTICAST_ADDR 224, 0, 0, 251
+#define MDNS_HEADER_SIZE 12
+#define MDNS_NAME_SIZE 96
+#define MDNS_MAX_POINTERS 8
+
+#define MDNS_TYPE_A 1
+#define MDNS_TYPE_PTR 12
+#define MDNS_TYPE_TXT 16
+#define MDNS_TYPE_SRV 33
+#define MDNS_TYPE_ANY 255
+#define MDNS_CLASS_IN 0x0001
+#define MDNS_CACHE_FLUSH 0x8000
+
+static const char localLabel[] PROGMEM = "\x05" "local";
+static const char serviceLabels[] PROGMEM = "\x05" "_http" "\x04" "_tcp";
+static const char hostSuffix[] PROGMEM = ".local";
+static const char instanceSuffix[] PROGMEM = "._http._tcp.local";
+static const char txtRoom[] PROGMEM = "room=";
+static const char txtModel[] PROGMEM = "model=";
+static const char txtPath[] PROGMEM = "path=";
+
+WiFiUDP Mdns::udp;
+uint8_t* Mdns::packet = nullptr;
+uint16_t Mdns::packetLength = 0;
+char Mdns::hostname[HOSTNAME_SIZE];
+char Mdns::instance[SETTINGS_ROOM_NAME_SIZE];
+uint8_t Mdns::announcements = 0;
+bool Mdns::responseDue = false;
+uint32_t Mdns::multicastAt = 0;
+
+static size_t put16(uint8_t* buffer, size_t offset, uint16_t value) {
+  buffer[offset] = value >> 8;
+  buffer[offset + 1] = value & 0xFF;
+  return offset + 2;
+}
+
+static size_t putLabel(uint8_t* buffer, size_t offset, const char* label) {
+  size_t length = strlen(label);
+  buffer[offset] = length;
+  memcpy(buffer + offset + 1, label, length);
+  return offset + 1 + length;
+}
+
+static size_t putPointer(uint8_t* buffer, size_t offset, size_t target) {
+  return put16(buffer, offset, 0xC000 | target);
+}
+
+// Returns the offset of the record data, its length is filled in by endRecord()
+static size_t putRecord(uint8_t* buffer, size_t offset, uint16_t type, bool unique, uint32_t ttl) {
+  offset = put16(buffer, offset, type);
+  offset = put16(buffer, offset, unique ? MDNS_CLASS_IN | MDNS_CACHE_FLUSH : MDNS_CLASS_IN);
+  offset = put16(buffer, offset, ttl >> 16);
+  offset = put16(buffer, offset, ttl & 0xFFFF);
+  return offset + 2;
+}
+
+static void endRecord(uint8_t* buffer, size_t dataOffset, size_t offset) {
+  put16(buffer, dataOffset - 2, offset - dataOffset);
+}
+
+static size_t putText(uint8_t* buffer, size_t offset, PGM_P key, const char* value) {
+  size_t keyLength = strlen_P(key);
+  size_t valueLength = strlen(value);
+  buffer[offset] = keyLength + valueLength;
+  memcpy_P(buffer + offset + 1, key, keyLength);
+  memcpy(buffer + offset + 1 + keyLength, value, valueLength);
+  return offset + 1 + keyLength + valueLength;
+}
+
+// Decodes a possibly compressed name into dotted form, names that do not fit
+// are returned empty so they match nothing
+static bool readName(const uint8_t* data, size_t length, size_t* offset, char* name, size_t size) {
+  size_t position = *offset;
+  size_t written = 0;
+  uint8_t pointers = 0;
+  bool fits = true;
+  while (true) {
+    if (position >= length) return false;
+    uint8_t label = data[position];
+    if (label == 0) {
+      if (pointers == 0) *offset = position + 1;
+      break;
+    }
+    if ((label & 0xC0) == 0xC0) {
+      if (position + 1 >= length || pointers >= MDNS_MAX_POINTERS) return false;
+      if (pointers == 0) *offset = position + 2;
+      pointers++;
+      position = ((label & 0x3F) << 8) | data[position + 1];
+      continue;
+    }
+    if (label > 63 || position + 1 + label > length) return false;
+    if (written + label + 2 > size) fits = false;
+    if (fits) {
+      if (written > 0) name[written++] = '.';
+      memcpy(name + written, data + position + 1, label);
+      written += label;
+    }
+    position += 1 + label;
+  }
+  name[fits ? written : 0] = '\0';
+  return true;
+}
+
+static bool nameEquals(const char* name, const char* label, PGM_P suffix) {
+  size_t length = strlen(label);
+  return strncasecmp(name, label, length) == 0 && strcasecmp_P(name + length, suffix) == 0;
+}
+
+bool Mdns::begin() {
+  end();
+  if (!WiFi.isConnected() || !render()) return false;
+  if (!udp.beginMulticast(WiFi.localIP(), IPAddress(MDNS_MULTICAST_ADDR), MDNS_PORT)) {
+    log("Failed to start mDNS");
+    return false;
+  }
+  announcements = MDNS_ANNOUNCE_COUNT;
+  multicastAt = millis() - MDNS_RESPONSE_INTERVAL;
+  return true;
+}
+
+void Mdns::end() {
+  udp.stop();
+  free(packet);
+  packet = nullptr;
+  announcements = 0;
+  responseDue = false;
+}
+
+void Mdns::loop() {
+  if (packet == nullptr) return;
+  uint8_t query[MDNS_PACKET_SIZE];
+  bool unicast;
+  while (udp.parsePacket() > 0) {
+    int length = udp.read(query, sizeof(query));
+    if (length <= 0 || udp.remotePort() != MDNS_PORT || !matches(query, length, &unicast)) continue;
+    if (unicast) send(false);
+    else responseDue = true;
+  }
+
+  // Multicast answers are limited to one per second, queries arriving in the
+  // meantime share the next one
+  if ((responseDue || announcements > 0) && millis() - multicastAt >= MDNS_RESPONSE_INTERVAL) {
+    send(true);
+    multicastAt = millis();
+    responseDue = false;
+    if (announcements > 0) announcements--;
+  }
+}
+
+// All records fit in one packet, so every matching question is answered with
+// the same bytes. Names are compressed against the host name and the
+// instance name written before them.
+bool Mdns::render() {
+  getHostname(hostname, sizeof(hostname));
+  const char* roomName = Settings::getRoomName();
+  strlcpy(instance, SAVED_OR_DEFAULT_ROOM_NAME(roomName), sizeof(instance));
+  // Queries are compared as dotted names, a dot inside the label would never match
+  for (char* c = instance; *c != '\0'; c++) {
+    if (*c == '.') *c = '-';
+  }
+  IPAddress ip = WiFi.localIP();
+
+  uint8_t buffer[MDNS_PACKET_SIZE];
+  memset(buffer, 0, MDNS_HEADER_SIZE);
+  put16(buffer, 2, 0x8400); // Response, authoritative
+  put16(buffer, 6, 4);      // Answers
+  size_t offset = MDNS_HEADER_SIZE;
+
+  // <hostname>.local A
+  size_t hostOffset = offset;
+  offset = putLabel(buffer, offset, hostname);
+  size_t localOffset = offset;
+  memcpy_P(buffer + offset, localLabel, sizeof(localLabel));
+  offset += sizeof(localLabel);
+  size_t data = putRecord(buffer, offset, MDNS_TYPE_A, true, MDNS_HOST_TTL);
+  for (uint8_t i = 0; i < 4; i++) buffer[data + i] = ip[i];
+  offset = data + 4;
+  endRecord(buffer, data, offset);
+
+  // _http._tcp.local PTR <instance>._http._tcp.local
+  size_t serviceOffset = offset;
+  memcpy_P(buffer + offset, serviceLabels, sizeof(serviceLabels) - 1);
+  offset = putPointer(buffer, offset + sizeof(serviceLabels) - 1, localOffset);
+  data = putRecord(buffer, offset, MDNS_TYPE_PTR, false, MDNS_SERVICE_TTL);
+  size_t instanceOffset = data;
+  offset = putPointer(buffer, putLabel(buffer, data, instance), serviceOffset);
+  endRecord(buffer, data, offset);
+
+  // <instance>._http._tcp.local SRV 0 0 <port> <hostname>.local
+  offset = putPointer(buffer, offset, instanceOffset);
+  data = putRecord(buffer, offset, MDNS_TYPE_SRV, true, MDNS_HOST_TTL);
+  offset = put16(buffer, data, 0);
+  offset = put16(buffer, offset, 0);
+  offset = put16(buffer, offset, MDNS_HTTP_PORT);
+  offset = putPointer(buffer, offset, hostOffset);
+  endRecord(buffer, data, offset);
+
+  // <instance>._http._tcp.local TXT
+  offset = putPointer(buffer, offset, instanceOffset);
+  data = putRecord(buffer, offset, MDNS_TYPE_TXT, true, MDNS_SERVICE_TTL);
+  offset = putText(buffer, data, txtRoom, SAVED_OR_DEFAULT_ROOM_NAME(roomName));
+  offset = putText(buffer, offset, txtModel, "SimpleHome");
+  offset = putText(buffer, offset, txtPath, "/commands");
+  endRecord(buffer, data, offset);
+
+  packet = (uint8_t*) malloc(offset);
+  if (packet == nullptr) return false;
+  memcpy(packet, buffer, offset);
+  packetLength = offset;
+  return true;
+}
+
+// Only queries are answered, the QU bit of every matching question decides
+// whether the answer goes to the sender or to the group
+bool Mdns::matches(const uint8_t* query, size_t length, bool* unicast) {
+  if (length < MDNS_HEADER_SIZE || (query[2] & 0xF8) != 0) return false;
+  uint16_t questions = (query[4] << 8) | query[5];
+  size_t offset = MDNS_HEADER_SIZE;
+  char name[MDNS_NAME_SIZE];
+  bool matched = false;
+  *unicast = true;
+  for (uint16_t i = 0; i < questions; i++) {
+    if (!readName(query, length, &offset, name, sizeof(name)) || offset + 4 > length) break;
+    uint16_t type = (query[offset] << 8) | query[offset + 1];
+    bool questionUnicast = (query[offset + 2] & 0x80) != 0;
+    offset += 4;
+    bool any = type == MDNS_TYPE_ANY;
+    if ((nameEquals(name, hostname, hostSuffix) && (any || type == MDNS_TYPE_A))
+        || (strcasecmp_P(name, instanceSuffix + 1) == 0 && (any || type == MDNS_TYPE_PTR))
+        || (nameEquals(name, instance, instanceSuffix) && (any || type == MDNS_TYPE_SRV || type == MDNS_TYPE_TXT))) {
+      matched = true;
+      *unicast = *unicast && questionUnicast;
+    }
+  }
+  return matched;
+}
+
+void Mdns::send(bool multicast) {
+  if (multicast) udp.beginPacketMulticast(IPAddress(MDNS_MULTICAST_ADDR), MDNS_PORT, WiFi.localIP(), 255);
+  else udp.beginPacket(udp.remoteIP(), udp.remotePort());
+  udp.write(packet, packetLength);
+  udp.endPacket();
+}
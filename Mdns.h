@@ -0,0 +1,39 @@
+#ifndef MDNS_H
+#define MDNS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <WiFiUdp.h>
+#include "Connectivity.h"
+#include "Settings.h"
+
+#define MDNS_PORT 5353
+#define MDNS_PACKET_SIZE 512
+#define MDNS_HOST_TTL 120
+#define MDNS_SERVICE_TTL 4500
+#define MDNS_ANNOUNCE_COUNT 2
+#define MDNS_RESPONSE_INTERVAL 1000
+#define MDNS_HTTP_PORT 80
+
+// Answers queries for <hostname>.local and the _http._tcp service with one
+// response that is rendered once per address
+class Mdns {
+  public:
+    static bool begin();
+    static void end();
+    static void loop();
+  private:
+    static bool render();
+    static bool matches(const uint8_t* query, size_t length, bool* unicast);
+    static void send(bool multicast);
+    static WiFiUDP udp;
+    static uint8_t* packet;
+    static uint16_t packetLength;
+    static char hostname[HOSTNAME_SIZE];
+    static char instance[SETTINGS_ROOM_NAME_SIZE];
+    static uint8_t announcements;
+    static bool responseDue;
+    static uint32_t multicastAt;
+};
+
+#endif
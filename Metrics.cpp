@@ -0,0 +1,439 @@
+#include "Metrics.h"
+
+#include <cstdarg>
+#include <Arduino.h>
+#include <ESP.h>
+#include <ESP8266WiFi.h>
+#include <StackThunk.h>
+#include "Config.h"
+#include "src/Mod_ESP8266Ping.h"
+#include "Power.h"
+
+#define METRICS_CHUNK_SIZE 512
+
+static const uint32_t latencyBounds[METRICS_LATENCY_BUCKETS] PROGMEM = {
+  1000, 2000, 5000, 10000, 25000, 50000, 100000, 250000
+};
+
+static const char latencyLabels[METRICS_LATENCY_BUCKETS][6] PROGMEM = {
+  "0.001", "0.002", "0.005", "0.01", "0.025", "0.05", "0.1", "0.25"
+};
+
+// The last bucket of every debug histogram collects everything above the last bound
+static const int32_t bytesBounds[METRICS_DEBUG_BUCKETS - 1] PROGMEM = {
+  0, 64, 256, 1024, 2048, 4096, 8192
+};
+
+static const int32_t deltaBounds[METRICS_DEBUG_BUCKETS - 1] PROGMEM = {
+  -1024, -256, -64, -1, 0, 64, 256
+};
+
+static uint8_t debugBucket(int32_t value, const int32_t* bounds) {
+  uint8_t i = 0;
+  while (i < METRICS_DEBUG_BUCKETS - 1 && value > (int32_t) pgm_read_dword(&bounds[i])) i++;
+  return i;
+}
+
+static void countDebugBucket(uint16_t* histogram, uint8_t bucket) {
+  if (histogram[bucket] < UINT16_MAX) histogram[bucket]++;
+}
+
+RouteMetrics Metrics::routes[METRICS_MAX_ROUTES];
+uint8_t Metrics::routeCount = 0;
+uint32_t Metrics::pendingBytes = 0;
+uint32_t Metrics::bytesSent = 0;
+uint32_t Metrics::rateLimited = 0;
+uint32_t Metrics::settingsCommits[2] = {0, 0};
+uint32_t Metrics::sensorReads[2][2] = {{0, 0}, {0, 0}};
+uint32_t Metrics::loopOverruns = 0;
+uint32_t Metrics::loopMaxDuration = 0;
+uint32_t Metrics::connectedAt = 0;
+uint32_t Metrics::reconnects = 0;
+uint32_t Metrics::downtime = 0;
+uint32_t Metrics::firstRequestAt = 0;
+uint32_t Metrics::heapFreeMin = UINT32_MAX;
+uint16_t Metrics::heapMaxBlockMin = UINT16_MAX;
+uint32_t Metrics::tlsHandshakes[3] = {0, 0, 0};
+uint32_t Metrics::tlsHandshakeLast = 0;
+uint32_t Metrics::tlsHandshakeMax = 0;
+uint32_t Metrics::tlsHeapMax = 0;
+
+class ChunkedResponse {
+  public:
+    ChunkedResponse(ESP8266WebServer* webServer) : server(webServer), length(0) {}
+
+    // Output that does not fit into an empty buffer is sent on its own, a
+    // truncated line would make the whole response unparseable
+    void printf_P(PGM_P format, ...) {
+      va_list args;
+      va_start(args, format);
+      int written = vsnprintf_P(buffer + length, sizeof(buffer) - length, format, args);
+      va_end(args);
+      if (written < 0 || (size_t) written < sizeof(buffer) - length) {
+        if (written > 0) length += written;
+        return;
+      }
+      flush();
+      char* target = buffer;
+      if ((size_t) written >= sizeof(buffer)) {
+        target = (char*) malloc(written + 1);
+        if (target == nullptr) return;
+      }
+      va_start(args, format);
+      vsnprintf_P(target, written + 1, format, args);
+      va_end(args);
+      if (target == buffer) {
+        length = written;
+        return;
+      }
+      send(target, written);
+      free(target);
+    }
+
+    void flush() {
+      if (length == 0) return;
+      send(buffer, length);
+      length = 0;
+    }
+
+  private:
+    void send(const char* content, size_t size) {
+      server->sendContent(content, size);
+      Metrics::countBytesSent(size);
+    }
+
+    ESP8266WebServer* server;
+    char buffer[METRICS_CHUNK_SIZE];
+    size_t length;
+};
+
+static PGM_P methodName(HTTPMethod method) {
+  switch (method) {
+    case HTTP_GET: return PSTR("GET");
+    case HTTP_HEAD: return PSTR("HEAD");
+    case HTTP_POST: return PSTR("POST");
+    case HTTP_PUT: return PSTR("PUT");
+    case HTTP_PATCH: return PSTR("PATCH");
+    case HTTP_DELETE: return PSTR("DELETE");
+    case HTTP_OPTIONS: return PSTR("OPTIONS");
+    default: return PSTR("ANY");
+  }
+}
+
+ESP8266WebServer::THandlerFunction Metrics::track(const __FlashStringHelper* path, HTTPMethod method, ESP8266WebServer::THandlerFunction handler) {
+  if (routeCount >= METRICS_MAX_ROUTES) return handler;
+  RouteMetrics* route = &routes[routeCount++];
+  memset(route, 0, sizeof(RouteMetrics));
+  route->path = path;
+  route->method = method;
+  return [route, handler]() {
+    uint32_t heapBefore;
+    uint16_t blockBefore;
+    ESP.getHeapStats(&heapBefore, &blockBefore, nullptr);
+    pendingBytes = 0;
+    uint32_t start = ESP.getCycleCount();
+    handler();
+    uint32_t cycles = ESP.getCycleCount() - start;
+    uint32_t heapAfter;
+    uint16_t blockAfter;
+    ESP.getHeapStats(&heapAfter, &blockAfter, nullptr);
+
+    uint32_t duration = cycles / ESP.getCpuFreqMHz();
+    route->requests++;
+    route->bytesSent += pendingBytes;
+    route->latencySum += duration;
+    for (uint8_t i = 0; i < METRICS_LATENCY_BUCKETS; i++) {
+      if (duration <= pgm_read_dword(&latencyBounds[i])) {
+        route->latencyBuckets[i]++;
+        break;
+      }
+    }
+    if (cycles > route->cyclesMax) route->cyclesMax = cycles;
+
+    int32_t heapDelta = (int32_t) heapAfter - (int32_t) heapBefore;
+    int32_t blockDelta = (int32_t) blockAfter - (int32_t) blockBefore;
+    if (heapDelta < route->heapDeltaMin) route->heapDeltaMin = heapDelta;
+    if (blockDelta < route->blockDeltaMin) route->blockDeltaMin = blockDelta;
+    countDebugBucket(route->bytesHistogram, debugBucket(pendingBytes, bytesBounds));
+    countDebugBucket(route->heapDeltaHistogram, debugBucket(heapDelta, deltaBounds));
+    countDebugBucket(route->blockDeltaHistogram, debugBucket(blockDelta, deltaBounds));
+
+    if (heapAfter < heapFreeMin) heapFreeMin = heapAfter;
+    if (blockAfter < heapMaxBlockMin) heapMaxBlockMin = blockAfter;
+    if (firstRequestAt == 0) firstRequestAt = millis();
+  };
+}
+
+void Metrics::countBytesSent(size_t bytes) {
+  pendingBytes += bytes;
+  bytesSent += bytes;
+}
+
+void Metrics::countSensorRead(bool temperature, bool humidity) {
+  sensorReads[0][temperature ? 0 : 1]++;
+  sensorReads[1][humidity ? 0 : 1]++;
+}
+
+void Metrics::countRateLimited() {
+  rateLimited++;
+}
+
+void Metrics::countSettingsCommit() {
+  settingsCommits[0]++;
+}
+
+void Metrics::countSettingsCommitAvoided() {
+  settingsCommits[1]++;
+}
+
+void Metrics::countLoop(uint32_t duration) {
+  if (duration > LOOP_DELAY) loopOverruns++;
+  if (duration > loopMaxDuration) loopMaxDuration = duration;
+}
+
+void Metrics::countConnected() {
+  if (connectedAt == 0) connectedAt = millis();
+}
+
+void Metrics::countReconnect(uint32_t duration) {
+  countConnected();
+  reconnects++;
+  downtime += duration / 1000;
+}
+
+// The duration covers the TCP connect and the handshake, ok counts full
+// handshakes only so the results add up to all attempts
+void Metrics::countTlsHandshake(bool success, bool resumed, uint32_t duration) {
+  tlsHandshakes[!success ? 2 : resumed ? 1 : 0]++;
+  if (!success) return;
+  tlsHandshakeLast = duration;
+  if (duration > tlsHandshakeMax) tlsHandshakeMax = duration;
+}
+
+void Metrics::countTlsHeap(uint32_t bytes) {
+  if (bytes > tlsHeapMax) tlsHeapMax = bytes;
+}
+
+void Metrics::sampleHeap() {
+  uint32_t heapFree;
+  uint16_t heapMaxBlock;
+  ESP.getHeapStats(&heapFree, &heapMaxBlock, nullptr);
+  if (heapFree < heapFreeMin) heapFreeMin = heapFree;
+  if (heapMaxBlock < heapMaxBlockMin) heapMaxBlockMin = heapMaxBlock;
+}
+
+void Metrics::print(ESP8266WebServer* server) {
+  ChunkedResponse response(server);
+
+  response.printf_P(PSTR(
+    "# TYPE simplehome_http_requests_total counter\n"
+    "# TYPE simplehome_http_response_bytes_total counter\n"
+    "# TYPE simplehome_http_request_duration_seconds histogram\n"
+  ));
+  for (uint8_t i = 0; i < routeCount; i++) {
+    RouteMetrics* route = &routes[i];
+    PGM_P path = (PGM_P) route->path;
+    PGM_P method = methodName(route->method);
+    response.printf_P(PSTR("simplehome_http_requests_total{path=\"%S\",method=\"%S\"} %u\n"), path, method, route->requests);
+    response.printf_P(PSTR("simplehome_http_response_bytes_total{path=\"%S\",method=\"%S\"} %u\n"), path, method, route->bytesSent);
+    uint32_t cumulative = 0;
+    for (uint8_t j = 0; j < METRICS_LATENCY_BUCKETS; j++) {
+      cumulative += route->latencyBuckets[j];
+      response.printf_P(PSTR("simplehome_http_request_duration_seconds_bucket{path=\"%S\",method=\"%S\",le=\"%S\"} %u\n"), path, method, latencyLabels[j], cumulative);
+    }
+    response.printf_P(
+      PSTR(
+        "simplehome_http_request_duration_seconds_bucket{path=\"%S\",method=\"%S\",le=\"+Inf\"} %u\n"
+        "simplehome_http_request_duration_seconds_sum{path=\"%S\",method=\"%S\"} %u.%06u\n"
+        "simplehome_http_request_duration_seconds_count{path=\"%S\",method=\"%S\"} %u\n"
+      ),
+      path, method, route->requests,
+      path, method, (uint32_t) (route->latencySum / 1000000), (uint32_t) (route->latencySum % 1000000),
+      path, method, route->requests
+    );
+  }
+
+  uint32_t heapFree;
+  uint16_t heapMaxBlock;
+  uint8_t heapFragmentation;
+  ESP.getHeapStats(&heapFree, &heapMaxBlock, &heapFragmentation);
+  // One call per metric family keeps every call well below the chunk size
+  response.printf_P(PSTR("# TYPE simplehome_bytes_sent_total counter\nsimplehome_bytes_sent_total %u\n"), bytesSent);
+  response.printf_P(PSTR("# TYPE simplehome_http_rate_limited_total counter\nsimplehome_http_rate_limited_total %u\n"), rateLimited);
+  response.printf_P(PSTR("# TYPE simplehome_heap_free_bytes gauge\nsimplehome_heap_free_bytes %u\n"), heapFree);
+  response.printf_P(PSTR("# TYPE simplehome_heap_free_min_bytes gauge\nsimplehome_heap_free_min_bytes %u\n"), heapFreeMin);
+  response.printf_P(PSTR("# TYPE simplehome_heap_max_block_bytes gauge\nsimplehome_heap_max_block_bytes %u\n"), heapMaxBlock);
+  response.printf_P(PSTR("# TYPE simplehome_heap_max_block_min_bytes gauge\nsimplehome_heap_max_block_min_bytes %u\n"), heapMaxBlockMin);
+  response.printf_P(PSTR("# TYPE simplehome_heap_fragmentation_percent gauge\nsimplehome_heap_fragmentation_percent %u\n"), heapFragmentation);
+
+  response.printf_P(
+    PSTR(
+      "# TYPE simplehome_sensor_reads_total counter\n"
+      "simplehome_sensor_reads_total{sensor=\"temperature\",result=\"ok\"} %u\n"
+      "simplehome_sensor_reads_total{sensor=\"temperature\",result=\"error\"} %u\n"
+      "simplehome_sensor_reads_total{sensor=\"humidity\",result=\"ok\"} %u\n"
+      "simplehome_sensor_reads_total{sensor=\"humidity\",result=\"error\"} %u\n"
+    ),
+    sensorReads[0][0], sensorReads[0][1],
+    sensorReads[1][0], sensorReads[1][1]
+  );
+
+  response.printf_P(
+    PSTR(
+      "# TYPE simplehome_pings_total counter\n"
+      "simplehome_pings_total{result=\"ok\"} %u\n"
+      "simplehome_pings_total{result=\"lost\"} %u\n"
+      "# TYPE simplehome_ping_lost_recent gauge\n"
+      "simplehome_ping_lost_recent %u\n"
+      "# TYPE simplehome_ping_lost_consecutive gauge\n"
+      "simplehome_ping_lost_consecutive %u\n"
+    ),
+    Ping.completed() - Ping.lost(), Ping.lost(),
+    Ping.lostInHistory(),
+    Ping.consecutiveLost()
+  );
+
+  // Round trip times cover the last PING_HISTORY_SIZE pings and are left out
+  // until a reply arrived, a single reply has no jitter yet
+  if (Ping.minTime() >= 0) {
+    uint32_t rttMin = Ping.minTime();
+    uint32_t rttAverage = Ping.averageTime();
+    uint32_t rttMax = Ping.maxTime();
+    int jitter = Ping.jitter();
+    uint32_t rttJitter = jitter > 0 ? jitter : 0;
+    response.printf_P(
+      PSTR(
+        "# TYPE simplehome_ping_rtt_seconds gauge\n"
+        "simplehome_ping_rtt_seconds{stat=\"min\"} %u.%03u\n"
+        "simplehome_ping_rtt_seconds{stat=\"avg\"} %u.%03u\n"
+        "simplehome_ping_rtt_seconds{stat=\"max\"} %u.%03u\n"
+        "simplehome_ping_rtt_seconds{stat=\"jitter\"} %u.%03u\n"
+      ),
+      rttMin / 1000, rttMin % 1000,
+      rttAverage / 1000, rttAverage % 1000,
+      rttMax / 1000, rttMax % 1000,
+      rttJitter / 1000, rttJitter % 1000
+    );
+  }
+
+  response.printf_P(PSTR("# TYPE simplehome_loop_overruns_total counter\nsimplehome_loop_overruns_total %u\n"), loopOverruns);
+  response.printf_P(PSTR("# TYPE simplehome_loop_duration_max_seconds gauge\nsimplehome_loop_duration_max_seconds %u.%03u\n"), loopMaxDuration / 1000, loopMaxDuration % 1000);
+  response.printf_P(PSTR("# TYPE simplehome_settings_commits_total counter\nsimplehome_settings_commits_total %u\n"), settingsCommits[0]);
+  response.printf_P(PSTR("# TYPE simplehome_settings_commits_avoided_total counter\nsimplehome_settings_commits_avoided_total %u\n"), settingsCommits[1]);
+  response.printf_P(PSTR("# TYPE simplehome_wifi_connected gauge\nsimplehome_wifi_connected %u\n"), WiFi.status() == WL_CONNECTED);
+  response.printf_P(PSTR("# TYPE simplehome_wifi_reconnects_total counter\nsimplehome_wifi_reconnects_total %u\n"), reconnects);
+  response.printf_P(PSTR("# TYPE simplehome_wifi_downtime_seconds_total counter\nsimplehome_wifi_downtime_seconds_total %u\n"), downtime);
+  response.printf_P(PSTR("# TYPE simplehome_boot_connected_seconds gauge\nsimplehome_boot_connected_seconds %u.%03u\n"), connectedAt / 1000, connectedAt % 1000);
+  response.printf_P(PSTR("# TYPE simplehome_boot_first_request_seconds gauge\nsimplehome_boot_first_request_seconds %u.%03u\n"), firstRequestAt / 1000, firstRequestAt % 1000);
+  response.printf_P(PSTR("# TYPE simplehome_uptime_seconds counter\nsimplehome_uptime_seconds %u\n"), millis() / 1000);
+
+  // The awake time belongs to the previous deep sleep cycle and is 0 in every other mode
+  uint32_t awakeTime = Power::getLastAwakeTime();
+  uint32_t energy = Power::getSampleEnergy();
+  response.printf_P(
+    PSTR(
+      "# TYPE simplehome_power_mode gauge\n"
+      "simplehome_power_mode{mode=\"%S\"} 1\n"
+      "# TYPE simplehome_power_sleep_cycles_total counter\n"
+      "simplehome_power_sleep_cycles_total %u\n"
+      "# TYPE simplehome_power_awake_seconds gauge\n"
+      "simplehome_power_awake_seconds %u.%03u\n"
+      "# TYPE simplehome_power_sample_energy_joules gauge\n"
+      "simplehome_power_sample_energy_joules %u.%06u\n"
+    ),
+    Power::getModeName(Power::getMode()),
+    Power::getCycles(),
+    awakeTime / 1000, awakeTime % 1000,
+    energy / 1000000, energy % 1000000
+  );
+
+  response.printf_P(
+    PSTR(
+      "# TYPE simplehome_tls_handshakes_total counter\n"
+      "simplehome_tls_handshakes_total{result=\"ok\"} %u\n"
+      "simplehome_tls_handshakes_total{result=\"resumed\"} %u\n"
+      "simplehome_tls_handshakes_total{result=\"failed\"} %u\n"
+      "# TYPE simplehome_tls_handshake_seconds gauge\n"
+      "simplehome_tls_handshake_seconds{stat=\"last\"} %u.%03u\n"
+      "simplehome_tls_handshake_seconds{stat=\"max\"} %u.%03u\n"
+    ),
+    tlsHandshakes[0], tlsHandshakes[1], tlsHandshakes[2],
+    tlsHandshakeLast / 1000, tlsHandshakeLast % 1000,
+    tlsHandshakeMax / 1000, tlsHandshakeMax % 1000
+  );
+
+  // BearSSL runs on its own stack, the thunk records how deep it went
+  response.printf_P(
+    PSTR(
+      "# TYPE simplehome_tls_heap_peak_bytes gauge\n"
+      "simplehome_tls_heap_peak_bytes %u\n"
+      "# TYPE simplehome_tls_stack_peak_bytes gauge\n"
+      "simplehome_tls_stack_peak_bytes %u\n"
+    ),
+    tlsHeapMax,
+    stack_thunk_get_max_usage()
+  );
+
+  response.flush();
+}
+
+static void printHistogram(ChunkedResponse& response, PGM_P name, const uint16_t* histogram) {
+  response.printf_P(PSTR(",\"%S\":[%u,%u,%u,%u,%u,%u,%u,%u]"),
+    name,
+    histogram[0], histogram[1], histogram[2], histogram[3],
+    histogram[4], histogram[5], histogram[6], histogram[7]
+  );
+}
+
+static void printBounds(ChunkedResponse& response, PGM_P name, const int32_t* bounds) {
+  response.printf_P(PSTR("\"%S\":["), name);
+  for (uint8_t i = 0; i < METRICS_DEBUG_BUCKETS - 1; i++) {
+    response.printf_P(i == 0 ? PSTR("%d") : PSTR(",%d"), (int32_t) pgm_read_dword(&bounds[i]));
+  }
+  response.printf_P(PSTR("]"));
+}
+
+void Metrics::printRoutes(ESP8266WebServer* server) {
+  ChunkedResponse response(server);
+
+  response.printf_P(PSTR("{\"cpuMHz\":%u,\"bounds\":{"), ESP.getCpuFreqMHz());
+  printBounds(response, PSTR("bytes"), bytesBounds);
+  response.printf_P(PSTR(","));
+  printBounds(response, PSTR("delta"), deltaBounds);
+  response.printf_P(PSTR("},\"routes\":["));
+  for (uint8_t i = 0; i < routeCount; i++) {
+    RouteMetrics* route = &routes[i];
+    response.printf_P(
+      PSTR("%S{\"path\":\"%S\",\"method\":\"%S\",\"requests\":%u,\"bytes\":%u,\"cyclesMax\":%u,\"heapDeltaMin\":%d,\"blockDeltaMin\":%d"),
+      i == 0 ? PSTR("") : PSTR(","),
+      (PGM_P) route->path,
+      methodName(route->method),
+      route->requests,
+      route->bytesSent,
+      route->cyclesMax,
+      route->heapDeltaMin,
+      route->blockDeltaMin
+    );
+    printHistogram(response, PSTR("bytesHistogram"), route->bytesHistogram);
+    printHistogram(response, PSTR("heapDeltaHistogram"), route->heapDeltaHistogram);
+    printHistogram(response, PSTR("blockDeltaHistogram"), route->blockDeltaHistogram);
+    response.printf_P(PSTR("}"));
+  }
+  response.printf_P(PSTR("]}"));
+
+  response.flush();
+}
+
+// Only the debug fields are cleared, the counters exported by /metrics must
+// never go backwards or scrapers see a counter reset
+void Metrics::resetRoutes() {
+  for (uint8_t i = 0; i < routeCount; i++) {
+    RouteMetrics* route = &routes[i];
+    route->cyclesMax = 0;
+    route->heapDeltaMin = 0;
+    route->blockDeltaMin = 0;
+    memset(route->bytesHistogram, 0, sizeof(route->bytesHistogram));
+    memset(route->heapDeltaHistogram, 0, sizeof(route->heapDeltaHistogram));
+    memset(route->blockDeltaHistogram, 0, sizeof(route->blockDeltaHistogram));
+  }
+}
@@ -0,0 +1,65 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <cstdint>
+#include <ESP8266WebServer.h>
+
+#define METRICS_MAX_ROUTES 24
+#define METRICS_LATENCY_BUCKETS 8
+#define METRICS_DEBUG_BUCKETS 8
+
+struct RouteMetrics {
+  const __FlashStringHelper* path;
+  HTTPMethod method;
+  uint32_t requests;
+  uint32_t bytesSent;
+  uint64_t latencySum;
+  uint32_t latencyBuckets[METRICS_LATENCY_BUCKETS];
+  uint32_t cyclesMax;
+  int32_t heapDeltaMin;
+  int32_t blockDeltaMin;
+  uint16_t bytesHistogram[METRICS_DEBUG_BUCKETS];
+  uint16_t heapDeltaHistogram[METRICS_DEBUG_BUCKETS];
+  uint16_t blockDeltaHistogram[METRICS_DEBUG_BUCKETS];
+};
+
+class Metrics {
+  public:
+    static ESP8266WebServer::THandlerFunction track(const __FlashStringHelper* path, HTTPMethod method, ESP8266WebServer::THandlerFunction handler);
+    static void countBytesSent(size_t bytes);
+    static void countSensorRead(bool temperature, bool humidity);
+    static void countRateLimited();
+    static void countSettingsCommit();
+    static void countSettingsCommitAvoided();
+    static void countLoop(uint32_t duration);
+    static void countConnected();
+    static void countReconnect(uint32_t downtime);
+    static void countTlsHandshake(bool success, bool resumed, uint32_t duration);
+    static void countTlsHeap(uint32_t bytes);
+    static void sampleHeap();
+    static void print(ESP8266WebServer* server);
+    static void printRoutes(ESP8266WebServer* server);
+    static void resetRoutes();
+  private:
+    static RouteMetrics routes[METRICS_MAX_ROUTES];
+    static uint8_t routeCount;
+    static uint32_t pendingBytes;
+    static uint32_t bytesSent;
+    static uint32_t rateLimited;
+    static uint32_t settingsCommits[2];
+    static uint32_t sensorReads[2][2];
+    static uint32_t loopOverruns;
+    static uint32_t loopMaxDuration;
+    static uint32_t connectedAt;
+    static uint32_t reconnects;
+    static uint32_t downtime;
+    static uint32_t firstRequestAt;
+    static uint32_t heapFreeMin;
+    static uint16_t heapMaxBlockMin;
+    static uint32_t tlsHandshakes[3];
+    static uint32_t tlsHandshakeLast;
+    static uint32_t tlsHandshakeMax;
+    static uint32_t tlsHeapMax;
+};
+
+#endif
@@ -0,0 +1,138 @@
+#include "Power.h"
+
+#include <Arduino.h>
+#include <ESP.h>
+#include <ESP8266WiFi.h>
+#include <coredecls.h>
+#include "Settings.h"
+#include "Config.h"
+#include "Logging.h"
+
+#define POWER_RTC_MAGIC 0x50575231
+#define POWER_RTC_OFFSET 0
+
+static const char modeNames[][12] PROGMEM = {
+  "default", "always-on", "modem-sleep", "light-sleep", "deep-sleep"
+};
+
+PowerRtcData Power::rtcData;
+bool Power::wokeFromDeepSleep = false;
+
+void Power::begin() {
+  wokeFromDeepSleep = ESP.getResetInfoPtr()->reason == REASON_DEEP_SLEEP_AWAKE;
+  bool valid = ESP.rtcUserMemoryRead(POWER_RTC_OFFSET, (uint32_t*) &rtcData, sizeof(rtcData))
+    && rtcData.magic == POWER_RTC_MAGIC
+    && rtcData.crc == crc32(&rtcData, offsetof(PowerRtcData, crc));
+  if (!valid || !wokeFromDeepSleep) memset(&rtcData, 0, sizeof(rtcData));
+}
+
+power_mode_t Power::getMode() {
+  uint8_t mode = Settings::getPowerMode();
+  if (mode == POWER_DEFAULT || mode > POWER_DEEP_SLEEP) return POWER_MODE_DEFAULT;
+  return (power_mode_t) mode;
+}
+
+// Listening only to every POWER_LISTEN_INTERVAL-th DTIM beacon lets the radio
+// stay off in between, the access point buffers frames meanwhile
+void Power::configureSleep() {
+  switch (getMode()) {
+    case POWER_MODEM_SLEEP:
+      WiFi.setSleepMode(WIFI_MODEM_SLEEP, POWER_LISTEN_INTERVAL);
+      break;
+    case POWER_LIGHT_SLEEP:
+      WiFi.setSleepMode(WIFI_LIGHT_SLEEP, POWER_LISTEN_INTERVAL);
+      break;
+    default:
+      WiFi.setSleepMode(WIFI_NONE_SLEEP);
+      break;
+  }
+}
+
+// A power-on or reset button press keeps the device reachable for
+// POWER_SETUP_WINDOW so the mode can be changed again
+bool Power::shouldSleep() {
+  if (getMode() != POWER_DEEP_SLEEP) return false;
+  if (!Settings::hasWiFi()) return false;
+  return wokeFromDeepSleep || millis() >= POWER_SETUP_WINDOW;
+}
+
+bool Power::isRadioOn() {
+  return !wokeFromDeepSleep || !rtcData.radioOff;
+}
+
+// Set on the boot that wakeRadio() started, its sample was taken by the boot before
+bool Power::isRadioRestart() {
+  return wokeFromDeepSleep && rtcData.radioRestart;
+}
+
+// The RF mode is chosen for the next wake, waking without radio skips the calibration
+void Power::sleep(bool radio) {
+  Settings::flush();
+  rtcData.cycles++;
+  rtcData.lastAwakeTime = millis();
+  rtcData.lastRadioOff = !isRadioOn();
+  rtcData.radioOff = !radio;
+  rtcData.radioRestart = false;
+  store();
+  log("Entering deep sleep...");
+  ESP.deepSleep((uint64_t) POWER_SLEEP_INTERVAL * 1000, radio ? WAKE_RF_DEFAULT : WAKE_RF_DISABLED);
+}
+
+// A wake without radio cannot enable it, reboot right away with calibrated RF instead
+void Power::wakeRadio() {
+  rtcData.radioOff = false;
+  rtcData.radioRestart = true;
+  store();
+  log("Restarting with radio...");
+  ESP.deepSleep(1, WAKE_RFCAL);
+}
+
+uint32_t Power::getCycles() {
+  return rtcData.cycles;
+}
+
+// Wake-to-sleep time of the previous deep sleep cycle, the boot ROM is not included
+uint32_t Power::getLastAwakeTime() {
+  return rtcData.lastAwakeTime;
+}
+
+// Estimated from the nominal currents in Config.h, in µJ
+uint32_t Power::getSampleEnergy() {
+  uint64_t charge;
+  switch (getMode()) {
+    case POWER_DEEP_SLEEP:
+      charge = (uint64_t) rtcData.lastAwakeTime * (rtcData.lastRadioOff ? POWER_RADIO_OFF_MILLIAMPS : POWER_ACTIVE_MILLIAMPS)
+        + (uint64_t) POWER_SLEEP_INTERVAL * POWER_DEEP_SLEEP_MICROAMPS / 1000;
+      break;
+    case POWER_MODEM_SLEEP:
+      charge = (uint64_t) PING_INTERVAL * AUTO_UPDATE_CYCLES * POWER_MODEM_SLEEP_MILLIAMPS;
+      break;
+    case POWER_LIGHT_SLEEP:
+      charge = (uint64_t) PING_INTERVAL * AUTO_UPDATE_CYCLES * POWER_LIGHT_SLEEP_MILLIAMPS;
+      break;
+    default:
+      charge = (uint64_t) PING_INTERVAL * AUTO_UPDATE_CYCLES * POWER_ACTIVE_MILLIAMPS;
+      break;
+  }
+  uint64_t energy = charge * POWER_SUPPLY_MILLIVOLTS / 1000;
+  return energy > UINT32_MAX ? UINT32_MAX : energy;
+}
+
+const char* Power::getModeName(power_mode_t mode) {
+  return modeNames[mode <= POWER_DEEP_SLEEP ? mode : POWER_DEFAULT];
+}
+
+bool Power::parseMode(const char* name, power_mode_t* mode) {
+  for (uint8_t i = POWER_DEFAULT; i <= POWER_DEEP_SLEEP; i++) {
+    if (strcmp_P(name, modeNames[i]) != 0) continue;
+    *mode = (power_mode_t) i;
+    return true;
+  }
+  return false;
+}
+
+void Power::store() {
+  rtcData.magic = POWER_RTC_MAGIC;
+  rtcData.crc = crc32(&rtcData, offsetof(PowerRtcData, crc));
+  ESP.rtcUserMemoryWrite(POWER_RTC_OFFSET, (uint32_t*) &rtcData, sizeof(rtcData));
+}
@@ -0,0 +1,49 @@
+#ifndef POWER_H
+#define POWER_H
+
+#include <cstdint>
+
+typedef enum {
+  POWER_DEFAULT = 0,
+  POWER_ALWAYS_ON,
+  POWER_MODEM_SLEEP,
+  POWER_LIGHT_SLEEP,
+  POWER_DEEP_SLEEP
+} power_mode_t;
+
+// Survives deep sleep in the RTC user memory
+struct PowerRtcData {
+  uint32_t magic;
+  uint32_t cycles;
+  uint32_t lastAwakeTime;
+  uint8_t lastRadioOff;
+  uint8_t radioOff;
+  uint8_t radioRestart;
+  uint8_t reserved;
+  uint32_t crc;
+};
+
+#define POWER_RTC_BLOCKS ((sizeof(PowerRtcData) + 3) / 4)
+
+class Power {
+  public:
+    static void begin();
+    static power_mode_t getMode();
+    static void configureSleep();
+    static bool shouldSleep();
+    static bool isRadioOn();
+    static bool isRadioRestart();
+    static void sleep(bool radio);
+    static void wakeRadio();
+    static uint32_t getCycles();
+    static uint32_t getLastAwakeTime();
+    static uint32_t getSampleEnergy();
+    static const char* getModeName(power_mode_t mode);
+    static bool parseMode(const char* name, power_mode_t* mode);
+  private:
+    static void store();
+    static PowerRtcData rtcData;
+    static bool wokeFromDeepSleep;
+};
+
+#endif
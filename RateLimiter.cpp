@@ -0,0 +1,79 @@
+#include "RateLimiter.h"
+
+#include <Arduino.h>
+#include "Files.h"
+#include "Metrics.h"
+#include "Logging.h"
+#include "Config.h"
+
+// Token counts are kept in thousandths so slow refill rates do not round down to zero
+#define TOKEN 1000
+
+static const char tooManyRequests[] PROGMEM =
+  "HTTP/1.1 429 Too Many Requests\r\n"
+  "Retry-After: 1\r\n"
+  "Content-Length: 0\r\n"
+  "Connection: close\r\n"
+  "\r\n";
+
+ClientBucket RateLimiter::clients[RATE_LIMITER_CLIENTS];
+uint16_t RateLimiter::requestsPerMinute = RATE_LIMIT_PER_MINUTE;
+uint16_t RateLimiter::burst = RATE_LIMIT_BURST;
+
+void RateLimiter::begin(ESP8266WebServer* server) {
+  char limits[16];
+  if (readFromFile("rate_limit", limits, sizeof(limits)) > 0) {
+    char* separator;
+    requestsPerMinute = strtoul(limits, &separator, 10);
+    if (*separator == ',') burst = strtoul(separator + 1, nullptr, 10);
+  }
+  if (burst == 0) burst = 1;
+  memset(clients, 0, sizeof(clients));
+
+  if (requestsPerMinute == 0) {
+    log("Rate limiting is disabled");
+    return;
+  }
+
+  server->addHook([](const String& method, const String& url, WiFiClient* client, ESP8266WebServer::ContentTypeFunction contentType) {
+    if (allow(client->remoteIP().v4())) return ESP8266WebServer::CLIENT_REQUEST_CAN_CONTINUE;
+    client->write_P(tooManyRequests, sizeof(tooManyRequests) - 1);
+    Metrics::countRateLimited();
+    return ESP8266WebServer::CLIENT_MUST_STOP;
+  });
+}
+
+bool RateLimiter::allow(uint32_t address) {
+  uint32_t now = millis();
+  ClientBucket* bucket = nullptr;
+  ClientBucket* oldest = &clients[0];
+  for (uint8_t i = 0; i < RATE_LIMITER_CLIENTS; i++) {
+    if (clients[i].address == address) {
+      bucket = &clients[i];
+      break;
+    }
+    if (now - clients[i].lastSeen > now - oldest->lastSeen) oldest = &clients[i];
+  }
+
+  if (bucket == nullptr) {
+    bucket = oldest;
+    bucket->address = address;
+    bucket->tokens = burst * TOKEN;
+    bucket->lastRefill = now;
+  } else {
+    uint32_t elapsed = now - bucket->lastRefill;
+    if (elapsed > 60000) elapsed = 60000;
+    // TOKEN / 60000 ms reduces to 1 / 60
+    uint32_t refill = elapsed * requestsPerMinute / 60;
+    if (refill > 0) {
+      bucket->tokens += refill;
+      if (bucket->tokens > burst * TOKEN) bucket->tokens = burst * TOKEN;
+      bucket->lastRefill = now;
+    }
+  }
+  bucket->lastSeen = now;
+
+  if (bucket->tokens < TOKEN) return false;
+  bucket->tokens -= TOKEN;
+  return true;
+}
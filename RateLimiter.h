@@ -0,0 +1,26 @@
+#ifndef RATE_LIMITER_H
+#define RATE_LIMITER_H
+
+#include <cstdint>
+#include <ESP8266WebServer.h>
+
+#define RATE_LIMITER_CLIENTS 8
+
+struct ClientBucket {
+  uint32_t address;
+  uint32_t tokens;
+  uint32_t lastRefill;
+  uint32_t lastSeen;
+};
+
+class RateLimiter {
+  public:
+    static void begin(ESP8266WebServer* server);
+  private:
+    static bool allow(uint32_t address);
+    static ClientBucket clients[RATE_LIMITER_CLIENTS];
+    static uint16_t requestsPerMinute;
+    static uint16_t burst;
+};
+
+#endif
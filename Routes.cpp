@@ -4,11 +4,110 @@
 #include <Arduino.h>
 #include <ESP.h>
 #include <ESP8266WiFi.h>
-#include "Files.h"
+#include "Settings.h"
+#include "Json.h"
 #include "Connectivity.h"
+#include "Metrics.h"
+#include "Power.h"
+#include "src/Mod_ESP8266SSDP.h"
+#include "Mdns.h"
 #include "Logging.h"
 #include "Config.h"
 
+static const char authModeOpen[] PROGMEM = "open";
+static const char authModeWep[] PROGMEM = "wep";
+static const char authModeWpa[] PROGMEM = "wpa";
+static const char authModeWpa2[] PROGMEM = "wpa2";
+static const char authModeWpaWpa2[] PROGMEM = "wpa/wpa2";
+static const char authModeUnknown[] PROGMEM = "unknown";
+
+static PGM_P authModeName(uint8_t authMode) {
+  switch (authMode) {
+    case AUTH_OPEN: return authModeOpen;
+    case AUTH_WEP: return authModeWep;
+    case AUTH_WPA_PSK: return authModeWpa;
+    case AUTH_WPA2_PSK: return authModeWpa2;
+    case AUTH_WPA_WPA2_PSK: return authModeWpaWpa2;
+    default: return authModeUnknown;
+  }
+}
+
+static void appendJsonEscaped(String& page, const char* value) {
+  for (; *value; value++) {
+    char c = *value;
+    if (c == '"' || c == '\\') {
+      page += '\\';
+      page += c;
+    } else if ((uint8_t) c < 0x20) {
+      char escaped[7];
+      sprintf_P(escaped, PSTR("\\u%04x"), c);
+      page += escaped;
+    } else {
+      page += c;
+    }
+  }
+}
+
+static void appendJsonAddress(String& page, PGM_P key, uint32_t address) {
+  page += F(",\"");
+  page += FPSTR(key);
+  page += F("\":\"");
+  if (address != 0) page += IPAddress(address).toString();
+  page += '"';
+}
+
+static bool readJsonAddress(JsonReader& json, uint32_t* address) {
+  char value[16];
+  if (!json.readString(value, sizeof(value))) return false;
+  if (value[0] == '\0') {
+    *address = 0;
+    return true;
+  }
+  IPAddress parsed;
+  if (!parsed.fromString(value)) return false;
+  *address = parsed.v4();
+  return true;
+}
+
+// Entries without a password keep the stored password of the same SSID,
+// a new SSID without one could never connect and is rejected
+static bool readJsonNetworks(JsonReader& json, KnownNetwork* networks) {
+  memset(networks, 0, sizeof(KnownNetwork) * SETTINGS_NETWORK_COUNT);
+  if (!json.beginArray()) return false;
+  uint8_t count = 0;
+  char key[16];
+  while (json.nextItem()) {
+    if (count == SETTINGS_NETWORK_COUNT || !json.beginObject()) return false;
+    KnownNetwork* network = &networks[count++];
+    bool hasPassword = false;
+    while (json.nextKey(key, sizeof(key))) {
+      if (strcmp_P(key, PSTR("ssid")) == 0) {
+        if (!json.readString(network->ssid, sizeof(network->ssid))) return false;
+      } else if (strcmp_P(key, PSTR("password")) == 0) {
+        if (!json.readString(network->password, sizeof(network->password))) return false;
+        hasPassword = network->password[0] != '\0';
+      } else {
+        return false;
+      }
+    }
+    if (json.failed() || network->ssid[0] == '\0') return false;
+    for (uint8_t i = 0; i < SETTINGS_NETWORK_COUNT && !hasPassword; i++) {
+      if (strcmp(Settings::getSsid(i), network->ssid) != 0) continue;
+      strlcpy(network->password, Settings::getPassword(i), sizeof(network->password));
+      hasPassword = true;
+    }
+    if (!hasPassword) return false;
+  }
+  return !json.failed();
+}
+
+// The mDNS answer carries the room name, the SSDP packets do not and keep
+// their cache. The description is rendered again so its ETag follows.
+static void updateDiscovery() {
+  SSDP.invalidateSchema();
+  Mdns::begin();
+}
+
 Routes::Routes(ESP8266WebServer* webServer) {
   server = webServer;
 }
@@ -17,7 +116,7 @@ bool Routes::shouldRestart = false;
 
 void Routes::handleRoot() {
   server->keepAlive(false);
-  server->send(
+  send(
     200,
     MIME_HTML,
     F(
@@ -36,7 +135,7 @@ void Routes::handleRoot() {
 }
 
 void Routes::handleWiFi() {
-  char* ssid = readFromFile("ssid");
+  startWiFiScan();
   String page;
   page += F(
             "<!doctype html><html>" HTML_HEAD "<body>"
@@ -47,7 +146,7 @@ void Routes::handleWiFi() {
             "<form method='POST' action='wifi-save'>"
             "<input type='text' placeholder='SSID' name='ssid' value='"
           );
-  page += ssid;
+  page += Settings::getSsid(Settings::getLastNetwork());
   page += F(
             "' required />"
             "<input type='password' placeholder='Password' name='password' required />"
@@ -61,13 +160,12 @@ void Routes::handleWiFi() {
   server->sendHeader(F("Cache-Control"), F("no-cache, no-store, must-revalidate"));
   server->sendHeader(F("Expires"), F("0"));
   server->keepAlive(false);
-  server->send(200, MIME_HTML, page);
-  free(ssid);
+  send(200, MIME_HTML, page);
 }
 
 void Routes::handleWiFiScript() {
   server->keepAlive(false);
-  server->send(
+  send(
     200,
     F("text/javascript"),
     F(
@@ -75,11 +173,16 @@ void Routes::handleWiFiScript() {
       "loadNetworks();"
       "function loadNetworks() {"
         "fetch('/wifi-result').then(response => {"
-          "if (!response.ok) console.error(response.status);"
+          "if (response.status == 202) setTimeout(loadNetworks, 1000);"
+          "else if (!response.ok) console.error(response.status);"
           "else return response.json();"
         "}).then(json => {"
+          "if (!json) return;"
           "list.innerHTML = '';"
-          "json.forEach(element => appendItem(element));"
+          "if (json.length == 0) appendItem('No networks found');"
+          "json.forEach(network => appendItem("
+            "network.ssid + ' (' + network.rssi + ' dBm, channel ' + network.channel + ', ' + network.encryption + ')'"
+          "));"
         "}).catch(error => {"
           "console.error(error);"
           "list.innerHTML = '';"
@@ -96,33 +199,45 @@ void Routes::handleWiFiScript() {
 }
 
 void Routes::handleWiFiResult() {
+  startWiFiScan();
+  if (isWiFiScanRunning()) {
+    server->keepAlive(false);
+    send(202, F("application/json"), F("[]"));
+    return;
+  }
+
+  const ScannedNetwork* networks;
+  uint8_t n = getScannedNetworks(&networks);
   String page;
-  page += F("[");
-  uint8_t n = WiFi.scanNetworks();
-  if (n > 0) {
-    for (uint8_t i = 0; i < n; i++) {
-      page += '"';
-      page += WiFi.SSID(i);
-      page += '"';
-      if (i != n - 1) page += ',';
-    }
-  } else {
-    page += F("\"No networks found\"");
+  page.reserve(n * 96 + 2);
+  page += '[';
+  for (uint8_t i = 0; i < n; i++) {
+    if (i > 0) page += ',';
+    page += F("{\"ssid\":\"");
+    appendJsonEscaped(page, networks[i].ssid);
+    page += F("\",\"rssi\":");
+    page += networks[i].rssi;
+    page += F(",\"channel\":");
+    page += networks[i].channel;
+    page += F(",\"encryption\":\"");
+    page += FPSTR(authModeName(networks[i].authMode));
+    page += F("\"}");
   }
-  page += F("]");
+  page += ']';
 
+  server->sendHeader(F("Cache-Control"), F("no-cache, no-store, must-revalidate"));
   server->keepAlive(false);
-  server->send(200, F("application/json"), page);
+  send(200, F("application/json"), page);
 }
 
 void Routes::handleWiFiSave() {
   Routes::shouldRestart = true;
-  char ssid[32] = "";
-  char password[32] = "";
-  server->arg("ssid").toCharArray(ssid, sizeof(ssid) - 1);
-  server->arg("password").toCharArray(password, sizeof(password) - 1);
+  char ssid[SETTINGS_SSID_SIZE] = "";
+  char password[SETTINGS_PASSWORD_SIZE] = "";
+  server->arg("ssid").toCharArray(ssid, sizeof(ssid));
+  server->arg("password").toCharArray(password, sizeof(password));
   server->keepAlive(false);
-  server->send(
+  send(
     200,
     MIME_HTML,
     F(
@@ -133,13 +248,12 @@ void Routes::handleWiFiSave() {
       "</body></html>"
     )
   );
-  writeToFile("ssid", ssid);
-  writeToFile("password", password);
+  Settings::addWiFi(ssid, password);
   log("Changed wifi config");
 }
 
 void Routes::handleRoomName() {
-  char* roomName = readFromFile("room_name");
+  const char* roomName = Settings::getRoomName();
   String page;
   page += F(
             "<!doctype html><html>" HTML_HEAD "<body>"
@@ -165,15 +279,14 @@ void Routes::handleRoomName() {
   server->sendHeader(F("Cache-Control"), F( "no-cache, no-store, must-revalidate"));
   server->sendHeader(F("Expires"), F("0"));
   server->keepAlive(false);
-  server->send(200, MIME_HTML, page);
-  free(roomName);
+  send(200, MIME_HTML, page);
 }
 
 void Routes::handleRoomNameSave() {
-  char roomName[32] = "";
-  server->arg("name").toCharArray(roomName, sizeof(roomName) - 1);
+  char roomName[SETTINGS_ROOM_NAME_SIZE] = "";
+  server->arg("name").toCharArray(roomName, sizeof(roomName));
   server->keepAlive(false);
-  server->send(
+  send(
     200,
     MIME_HTML,
     F(
@@ -184,19 +297,19 @@ void Routes::handleRoomNameSave() {
       "</body></html>"
     )
   );
-  writeToFile("room_name", roomName);
+  if (Settings::setRoomName(roomName)) updateDiscovery();
   log("Changed room name");
 }
 
 void Routes::handleWeather() {
-  char* weatherDisplay = readFromFile("weather");
+  bool weatherEnabled = Settings::isWeatherEnabled();
   String page;
   page += F(
             "<!doctype html><html>" HTML_HEAD "<body>"
             "<h1>Weather Display</h1>"
             "<p>Currently the weather display is "
           );
-  page += strcmp(weatherDisplay, "1") == 0 ? "enabled" : "disabled";
+  page += weatherEnabled ? "enabled" : "disabled";
   page += F(
             ". Please note that weather data is fetched from the Internet. "
             "Data that can be regarded personal will get transmitted to the weather provider.</p>"
@@ -204,7 +317,7 @@ void Routes::handleWeather() {
             "<form method='POST' action='weather-save'>"
             "<input type='hidden' name='bool' value='"
           );
-  page += strcmp(weatherDisplay, "1") == 0 ? "0" : "1";
+  page += weatherEnabled ? "0" : "1";
   page += F(
             "' />"
             "<input type='submit' value='Toggle' />"
@@ -216,15 +329,13 @@ void Routes::handleWeather() {
   server->sendHeader(F("Cache-Control"), F( "no-cache, no-store, must-revalidate"));
   server->sendHeader(F("Expires"), F("0"));
   server->keepAlive(false);
-  server->send(200, MIME_HTML, page);
-  free(weatherDisplay);
+  send(200, MIME_HTML, page);
 }
 
 void Routes::handleWeatherSave() {
-  char weatherDisplay[32] = "";
-  server->arg("bool").toCharArray(weatherDisplay, sizeof(weatherDisplay) - 1);
+  bool weatherEnabled = server->arg("bool") == "1";
   server->keepAlive(false);
-  server->send(
+  send(
     200,
     MIME_HTML,
     F(
@@ -235,17 +346,14 @@ void Routes::handleWeatherSave() {
       "</body></html>"
     )
   );
-  writeToFile("weather", weatherDisplay);
+  Settings::setWeatherEnabled(weatherEnabled);
   log("Changed weather display");
 }
 
 void Routes::handleRequestRestart() {
   server->keepAlive(false);
-  server->send(200, F("text/javascript"), F("console.log('Restarting');"));
-  if (Routes::shouldRestart) {
-    delay(2000);
-    ESP.restart();
-  }
+  send(200, F("text/javascript"), F("console.log('Restarting');"));
+  if (Routes::shouldRestart) restart();
 }
 
 void Routes::handleStatus() {
@@ -296,13 +404,132 @@ void Routes::handleStatus() {
   server->sendHeader(F("Cache-Control"), F("no-cache, no-store, must-revalidate"));
   server->sendHeader(F("Expires"), F("0"));
   server->keepAlive(false);
-  server->send(200, MIME_HTML, page);
+  send(200, MIME_HTML, page);
   free(uptime);
 }
 
+void Routes::handleMetrics() {
+  server->keepAlive(false);
+  server->setContentLength(CONTENT_LENGTH_UNKNOWN);
+  server->send(200, F("text/plain; version=0.0.4"), emptyString);
+  Metrics::print(server);
+  server->sendContent(emptyString);
+}
+
+void Routes::handleDebugRoutes() {
+  server->sendHeader(F("Cache-Control"), F("no-cache, no-store, must-revalidate"));
+  server->keepAlive(false);
+  server->setContentLength(CONTENT_LENGTH_UNKNOWN);
+  server->send(200, F("application/json"), emptyString);
+  Metrics::printRoutes(server);
+  server->sendContent(emptyString);
+}
+
+void Routes::handleDebugRoutesReset() {
+  Metrics::resetRoutes();
+  server->keepAlive(false);
+  send(200, F("application/json"), F("{\"toast\":\"Reset route statistics\"}"));
+}
+
+void Routes::handleConfig() {
+  String page;
+  page += F("{\"networks\":[");
+  bool firstNetwork = true;
+  for (uint8_t i = 0; i < SETTINGS_NETWORK_COUNT; i++) {
+    if (Settings::getSsid(i)[0] == '\0') continue;
+    if (!firstNetwork) page += ',';
+    firstNetwork = false;
+    page += F("{\"ssid\":\"");
+    appendJsonEscaped(page, Settings::getSsid(i));
+    page += F("\"}");
+  }
+  page += F("],\"roomName\":\"");
+  appendJsonEscaped(page, Settings::getRoomName());
+  page += F("\",\"weather\":");
+  page += Settings::isWeatherEnabled() ? F("true") : F("false");
+  const StaticIpConfig* staticIp = Settings::getStaticIp();
+  appendJsonAddress(page, PSTR("staticIp"), staticIp->ip);
+  appendJsonAddress(page, PSTR("gateway"), staticIp->gateway);
+  appendJsonAddress(page, PSTR("subnet"), staticIp->subnet);
+  appendJsonAddress(page, PSTR("dns"), staticIp->dns);
+  page += F(",\"powerMode\":\"");
+  page += FPSTR(Power::getModeName((power_mode_t) Settings::getPowerMode()));
+  page += F("\",\"uploadUrl\":\"");
+  appendJsonEscaped(page, Settings::getUploadUrl());
+  page += F("\"}");
+
+  server->sendHeader(F("Cache-Control"), F("no-cache, no-store, must-revalidate"));
+  server->keepAlive(false);
+  send(200, F("application/json"), page);
+}
+
+void Routes::handleConfigSave() {
+  KnownNetwork networks[SETTINGS_NETWORK_COUNT];
+  char roomName[SETTINGS_ROOM_NAME_SIZE];
+  bool weatherEnabled = Settings::isWeatherEnabled();
+  StaticIpConfig staticIp = *Settings::getStaticIp();
+  power_mode_t powerMode = (power_mode_t) Settings::getPowerMode();
+  char powerModeName[12];
+  char uploadUrl[SETTINGS_UPLOAD_URL_SIZE];
+  strlcpy(uploadUrl, Settings::getUploadUrl(), sizeof(uploadUrl));
+  for (uint8_t i = 0; i < SETTINGS_NETWORK_COUNT; i++) {
+    strlcpy(networks[i].ssid, Settings::getSsid(i), sizeof(networks[i].ssid));
+    strlcpy(networks[i].password, Settings::getPassword(i), sizeof(networks[i].password));
+  }
+  strlcpy(roomName, Settings::getRoomName(), sizeof(roomName));
+
+  // Passwords are write-only, networks without one keep the current one
+  String body = server->arg("plain");
+  JsonReader json(body.c_str());
+  char key[16];
+  bool valid = json.beginObject();
+  while (valid && json.nextKey(key, sizeof(key))) {
+    if (strcmp_P(key, PSTR("networks")) == 0) valid = readJsonNetworks(json, networks);
+    else if (strcmp_P(key, PSTR("roomName")) == 0) valid = json.readString(roomName, sizeof(roomName));
+    else if (strcmp_P(key, PSTR("weather")) == 0) valid = json.readBool(&weatherEnabled);
+    else if (strcmp_P(key, PSTR("staticIp")) == 0) valid = readJsonAddress(json, &staticIp.ip);
+    else if (strcmp_P(key, PSTR("gateway")) == 0) valid = readJsonAddress(json, &staticIp.gateway);
+    else if (strcmp_P(key, PSTR("subnet")) == 0) valid = readJsonAddress(json, &staticIp.subnet);
+    else if (strcmp_P(key, PSTR("dns")) == 0) valid = readJsonAddress(json, &staticIp.dns);
+    else if (strcmp_P(key, PSTR("powerMode")) == 0) valid = json.readString(powerModeName, sizeof(powerModeName)) && Power::parseMode(powerModeName, &powerMode);
+    else if (strcmp_P(key, PSTR("uploadUrl")) == 0) valid = json.readString(uploadUrl, sizeof(uploadUrl));
+    else valid = false;
+  }
+  if (staticIp.ip != 0 && (staticIp.gateway == 0 || staticIp.subnet == 0)) valid = false;
+  if (uploadUrl[0] != '\0' && strncmp_P(uploadUrl, PSTR("http://"), 7) != 0) valid = false;
+  server->keepAlive(false);
+  if (!valid || !json.end()) {
+    send(400, F("application/json"), F("{\"error\":\"Invalid configuration\"}"));
+    return;
+  }
+
+  // Other networks are picked up by the background retry, only a changed
+  // current network or a device without any network needs a restart
+  bool wifiChanged = false;
+  bool wifiConfigured = Settings::hasWiFi();
+  uint8_t lastNetwork = Settings::getLastNetwork();
+  for (uint8_t i = 0; i < SETTINGS_NETWORK_COUNT; i++) {
+    if (Settings::setWiFi(i, networks[i].ssid, networks[i].password) && i == lastNetwork) wifiChanged = true;
+  }
+  if (!wifiConfigured && Settings::hasWiFi()) wifiChanged = true;
+  wifiChanged = Settings::setStaticIp(&staticIp) || wifiChanged;
+  if (Settings::setRoomName(roomName)) updateDiscovery();
+  Settings::setWeatherEnabled(weatherEnabled);
+  Settings::setUploadUrl(uploadUrl);
+  if (Settings::setPowerMode(powerMode)) Power::configureSleep();
+  Settings::flush();
+  log("Changed config");
+  if (wifiChanged) {
+    send(200, F("application/json"), F("{\"restart\":true}"));
+    restart();
+  } else {
+    send(200, F("application/json"), F("{\"restart\":false}"));
+  }
+}
+
 void Routes::handleCommand() {
   server->keepAlive(false);
-  server->send(
+  send(
     200,
     F("application/json"),
     F(
@@ -313,7 +540,7 @@ void Routes::handleCommand() {
 
 void Routes::handleCss() {
   server->keepAlive(false);
-  server->send(
+  send(
     200,
     F("text/css"),
     F(
@@ -328,7 +555,7 @@ void Routes::handleCss() {
 
 void Routes::handleNotFound() {
   server->keepAlive(false);
-  server->send(
+  send(
     404,
     MIME_HTML,
     F(
@@ -340,3 +567,21 @@ void Routes::handleNotFound() {
     )
   );
 }
+
+void Routes::send(int code, const __FlashStringHelper* contentType, const __FlashStringHelper* content) {
+  server->send(code, contentType, content);
+  Metrics::countBytesSent(strlen_P((PGM_P) content));
+}
+
+void Routes::send(int code, const __FlashStringHelper* contentType, const String& content) {
+  server->send(code, contentType, content);
+  Metrics::countBytesSent(content.length());
+}
+
+void Routes::restart() {
+  Settings::flush();
+  // Lets control points drop the device instead of waiting out their cache
+  SSDP.end();
+  delay(2000);
+  ESP.restart();
+}
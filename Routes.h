@@ -20,12 +20,20 @@ class Routes {
     void handleWeatherSave();
     void handleRequestRestart();
     void handleStatus();
+    void handleMetrics();
+    void handleDebugRoutes();
+    void handleDebugRoutesReset();
+    void handleConfig();
+    void handleConfigSave();
     void handleCommand();
     void handleCss();
     void handleNotFound();
     static bool shouldRestart;
   private:
     ESP8266WebServer* server;
+    void send(int code, const __FlashStringHelper* contentType, const __FlashStringHelper* content);
+    void send(int code, const __FlashStringHelper* contentType, const String& content);
+    void restart();
 };
 
 #endif
@@ -0,0 +1,91 @@
+#include "SampleBuffer.h"
+
+#include <cstddef>
+#include <Arduino.h>
+#include <ESP.h>
+#include <coredecls.h>
+#include "Power.h"
+#include "Config.h"
+
+#define SAMPLE_BUFFER_MAGIC 0x53424631
+
+SampleBufferData SampleBuffer::data;
+
+void SampleBuffer::begin() {
+  bool valid = ESP.rtcUserMemoryRead(POWER_RTC_BLOCKS, (uint32_t*) &data, sizeof(data))
+    && data.magic == SAMPLE_BUFFER_MAGIC
+    && data.count <= SAMPLE_BUFFER_CAPACITY
+    && data.crc == crc32(&data, offsetof(SampleBufferData, crc));
+  if (!valid) {
+    memset(&data, 0, sizeof(data));
+    data.magic = SAMPLE_BUFFER_MAGIC;
+    data.lastUploaded.temperature = SAMPLE_INVALID_TEMPERATURE;
+    data.lastUploaded.humidity = SAMPLE_INVALID_HUMIDITY;
+  }
+}
+
+// Changes are measured from the first valid value until something was uploaded
+static void updateReference(Sample* reference, const Sample* sample, bool uploaded) {
+  if (sample->temperature != SAMPLE_INVALID_TEMPERATURE && (uploaded || reference->temperature == SAMPLE_INVALID_TEMPERATURE)) {
+    reference->temperature = sample->temperature;
+  }
+  if (sample->humidity != SAMPLE_INVALID_HUMIDITY && (uploaded || reference->humidity == SAMPLE_INVALID_HUMIDITY)) {
+    reference->humidity = sample->humidity;
+  }
+}
+
+// The boot counter numbers every sampling wake, a batch is identified by the
+// boot of its oldest sample so a repeated upload can be recognized by the
+// receiver. A full buffer drops its oldest sample. NaN marks a failed read.
+void SampleBuffer::add(float temperature, float humidity) {
+  data.bootCount++;
+  Sample* sample = &data.samples[data.head];
+  sample->temperature = isnan(temperature) ? SAMPLE_INVALID_TEMPERATURE : lroundf(temperature * 10);
+  sample->humidity = isnan(humidity) ? SAMPLE_INVALID_HUMIDITY : lroundf(humidity * 10);
+  data.head = (data.head + 1) % SAMPLE_BUFFER_CAPACITY;
+  if (data.count < SAMPLE_BUFFER_CAPACITY) data.count++;
+  updateReference(&data.lastUploaded, sample, false);
+  store();
+}
+
+uint16_t SampleBuffer::getCount() {
+  return data.count;
+}
+
+uint32_t SampleBuffer::getFirstBoot() {
+  return data.bootCount - data.count + 1;
+}
+
+// Index 0 is the oldest sample
+const Sample* SampleBuffer::getSample(uint16_t index) {
+  return &data.samples[(data.head + SAMPLE_BUFFER_CAPACITY - data.count + index) % SAMPLE_BUFFER_CAPACITY];
+}
+
+bool SampleBuffer::isUploadDue() {
+  return data.count >= SAMPLE_BUFFER_UPLOAD_LEVEL || hasChanged();
+}
+
+bool SampleBuffer::isUploadDueNextWake() {
+  return data.count + 1 >= SAMPLE_BUFFER_UPLOAD_LEVEL || hasChanged();
+}
+
+void SampleBuffer::clear() {
+  if (data.count > 0) updateReference(&data.lastUploaded, getSample(data.count - 1), true);
+  data.count = 0;
+  store();
+}
+
+bool SampleBuffer::hasChanged() {
+  if (data.count == 0) return false;
+  const Sample* latest = getSample(data.count - 1);
+  const Sample* reference = &data.lastUploaded;
+  bool temperatureValid = latest->temperature != SAMPLE_INVALID_TEMPERATURE && reference->temperature != SAMPLE_INVALID_TEMPERATURE;
+  bool humidityValid = latest->humidity != SAMPLE_INVALID_HUMIDITY && reference->humidity != SAMPLE_INVALID_HUMIDITY;
+  return (temperatureValid && abs(latest->temperature - reference->temperature) >= SAMPLE_TEMPERATURE_THRESHOLD)
+    || (humidityValid && abs(latest->humidity - reference->humidity) >= SAMPLE_HUMIDITY_THRESHOLD);
+}
+
+void SampleBuffer::store() {
+  data.crc = crc32(&data, offsetof(SampleBufferData, crc));
+  ESP.rtcUserMemoryWrite(POWER_RTC_BLOCKS, (uint32_t*) &data, sizeof(data));
+}
@@ -0,0 +1,43 @@
+#ifndef SAMPLE_BUFFER_H
+#define SAMPLE_BUFFER_H
+
+#include <cstdint>
+
+#define SAMPLE_BUFFER_CAPACITY 64
+#define SAMPLE_INVALID_TEMPERATURE INT16_MIN
+#define SAMPLE_INVALID_HUMIDITY UINT16_MAX
+
+// Fixed-point values in tenths of a degree and tenths of a percent, a failed
+// read keeps its slot so later samples stay on their wake
+struct Sample {
+  int16_t temperature;
+  uint16_t humidity;
+};
+
+struct SampleBufferData {
+  uint32_t magic;
+  uint32_t bootCount;
+  uint16_t head;
+  uint16_t count;
+  Sample lastUploaded;
+  Sample samples[SAMPLE_BUFFER_CAPACITY];
+  uint32_t crc;
+};
+
+class SampleBuffer {
+  public:
+    static void begin();
+    static void add(float temperature, float humidity);
+    static uint16_t getCount();
+    static uint32_t getFirstBoot();
+    static const Sample* getSample(uint16_t index);
+    static bool isUploadDue();
+    static bool isUploadDueNextWake();
+    static void clear();
+  private:
+    static bool hasChanged();
+    static void store();
+    static SampleBufferData data;
+};
+
+#endif
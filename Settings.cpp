@@ -0,0 +1,243 @@
+#include "Settings.h"
+
+#include <cstddef>
+#include <Arduino.h>
+#include <coredecls.h>
+#include "Files.h"
+#include "Metrics.h"
+#include "Config.h"
+#include "Logging.h"
+
+#define SETTINGS_MAGIC 0x53485354
+#define SETTINGS_VERSION 1
+
+// Records are written to the slots alternately, so a reset during a write
+// leaves the previous record intact in the other slot
+static const char* const slots[2] = { "settings.0", "settings.1" };
+
+SettingsRecord Settings::record;
+bool Settings::dirty = false;
+uint32_t Settings::changedAt = 0;
+
+void Settings::begin() {
+  SettingsRecord candidate;
+  memset(&record, 0, sizeof(record));
+  for (uint8_t slot = 0; slot < 2; slot++) {
+    if (load(slot, &candidate) && (record.magic != SETTINGS_MAGIC || (int32_t) (candidate.sequence - record.sequence) > 0)) {
+      record = candidate;
+    }
+  }
+  if (record.magic != SETTINGS_MAGIC) migrate();
+}
+
+const char* Settings::getSsid(uint8_t index) {
+  return ssidField(index);
+}
+
+const char* Settings::getPassword(uint8_t index) {
+  return passwordField(index);
+}
+
+bool Settings::hasWiFi() {
+  for (uint8_t i = 0; i < SETTINGS_NETWORK_COUNT; i++) {
+    if (hasWiFi(i)) return true;
+  }
+  return false;
+}
+
+bool Settings::hasWiFi(uint8_t index) {
+  return strlen(ssidField(index)) > 0 && strlen(passwordField(index)) > 0;
+}
+
+uint8_t Settings::getLastNetwork() {
+  return record.data.lastNetwork < SETTINGS_NETWORK_COUNT ? record.data.lastNetwork : 0;
+}
+
+const char* Settings::getRoomName() {
+  return record.data.roomName;
+}
+
+bool Settings::isWeatherEnabled() {
+  return record.data.weatherEnabled;
+}
+
+const uint8_t* Settings::getBssid() {
+  return record.data.bssid;
+}
+
+uint8_t Settings::getChannel() {
+  return record.data.channel;
+}
+
+const StaticIpConfig* Settings::getStaticIp() {
+  return &record.data.staticIp;
+}
+
+uint8_t Settings::getPowerMode() {
+  return record.data.powerMode;
+}
+
+const char* Settings::getUploadUrl() {
+  return record.data.uploadUrl;
+}
+
+bool Settings::setWiFi(uint8_t index, const char* ssid, const char* password) {
+  bool changed = update(ssidField(index), SETTINGS_SSID_SIZE, ssid);
+  changed = update(passwordField(index), SETTINGS_PASSWORD_SIZE, password) || changed;
+  if (changed) {
+    if (index == getLastNetwork()) {
+      memset(record.data.bssid, 0, sizeof(record.data.bssid));
+      record.data.channel = 0;
+    }
+    markDirty();
+  }
+  else Metrics::countSettingsCommitAvoided();
+  return changed;
+}
+
+// Updates the entry with the same SSID, otherwise takes the first free entry
+// or replaces the last one that is not the current network. The entry becomes
+// the current network without a cached access point, so the next start
+// connects to it instead of taking the fast path to the previous one.
+bool Settings::addWiFi(const char* ssid, const char* password) {
+  uint8_t index = SETTINGS_NETWORK_COUNT;
+  for (uint8_t i = 0; i < SETTINGS_NETWORK_COUNT && index == SETTINGS_NETWORK_COUNT; i++) {
+    if (strcmp(ssidField(i), ssid) == 0) index = i;
+  }
+  for (uint8_t i = 0; i < SETTINGS_NETWORK_COUNT && index == SETTINGS_NETWORK_COUNT; i++) {
+    if (strlen(ssidField(i)) == 0) index = i;
+  }
+  if (index == SETTINGS_NETWORK_COUNT) {
+    index = SETTINGS_NETWORK_COUNT - 1;
+    if (index == getLastNetwork()) index--;
+  }
+  bool changed = setWiFi(index, ssid, password);
+  const uint8_t noBssid[sizeof(record.data.bssid)] = {};
+  return setLastNetwork(index, noBssid, 0) || changed;
+}
+
+bool Settings::setRoomName(const char* roomName) {
+  bool changed = update(record.data.roomName, sizeof(record.data.roomName), roomName);
+  if (changed) markDirty();
+  else Metrics::countSettingsCommitAvoided();
+  return changed;
+}
+
+bool Settings::setWeatherEnabled(bool enabled) {
+  bool changed = record.data.weatherEnabled != enabled;
+  record.data.weatherEnabled = enabled;
+  if (changed) markDirty();
+  else Metrics::countSettingsCommitAvoided();
+  return changed;
+}
+
+bool Settings::setLastNetwork(uint8_t index, const uint8_t* bssid, uint8_t channel) {
+  bool changed = record.data.lastNetwork != index || memcmp(record.data.bssid, bssid, sizeof(record.data.bssid)) != 0 || record.data.channel != channel;
+  record.data.lastNetwork = index;
+  memcpy(record.data.bssid, bssid, sizeof(record.data.bssid));
+  record.data.channel = channel;
+  if (changed) markDirty();
+  else Metrics::countSettingsCommitAvoided();
+  return changed;
+}
+
+bool Settings::setStaticIp(const StaticIpConfig* staticIp) {
+  bool changed = memcmp(&record.data.staticIp, staticIp, sizeof(StaticIpConfig)) != 0;
+  record.data.staticIp = *staticIp;
+  if (changed) markDirty();
+  else Metrics::countSettingsCommitAvoided();
+  return changed;
+}
+
+bool Settings::setPowerMode(uint8_t powerMode) {
+  bool changed = record.data.powerMode != powerMode;
+  record.data.powerMode = powerMode;
+  if (changed) markDirty();
+  else Metrics::countSettingsCommitAvoided();
+  return changed;
+}
+
+bool Settings::setUploadUrl(const char* uploadUrl) {
+  bool changed = update(record.data.uploadUrl, sizeof(record.data.uploadUrl), uploadUrl);
+  if (changed) markDirty();
+  else Metrics::countSettingsCommitAvoided();
+  return changed;
+}
+
+void Settings::loop() {
+  if (dirty && millis() - changedAt >= SETTINGS_COMMIT_DELAY) flush();
+}
+
+bool Settings::flush() {
+  if (!dirty) return true;
+  if (!commit()) {
+    log("Failed to save settings");
+    changedAt = millis();
+    return false;
+  }
+  dirty = false;
+  return true;
+}
+
+bool Settings::load(uint8_t slot, SettingsRecord* result) {
+  memset(result, 0, sizeof(SettingsRecord));
+  size_t length = readBinaryFile(slots[slot], result, sizeof(SettingsRecord));
+  if (length < offsetof(SettingsRecord, data)) return false;
+  if (result->magic != SETTINGS_MAGIC || result->version != SETTINGS_VERSION) return false;
+  if (result->length > sizeof(SettingsData) || length < offsetof(SettingsRecord, data) + result->length) return false;
+  return crc32(&result->data, result->length) == result->crc;
+}
+
+void Settings::migrate() {
+  log("Migrating settings files...");
+  char weatherDisplay[2];
+  readFromFile("ssid", record.data.ssid, sizeof(record.data.ssid));
+  readFromFile("password", record.data.password, sizeof(record.data.password));
+  readFromFile("room_name", record.data.roomName, sizeof(record.data.roomName));
+  readFromFile("weather", weatherDisplay, sizeof(weatherDisplay));
+  record.data.weatherEnabled = strcmp(weatherDisplay, "1") == 0;
+  if (!commit()) return;
+  removeFile("ssid");
+  removeFile("password");
+  removeFile("room_name");
+  removeFile("weather");
+}
+
+char* Settings::ssidField(uint8_t index) {
+  return index == 0 ? record.data.ssid : record.data.networks[index - 1].ssid;
+}
+
+char* Settings::passwordField(uint8_t index) {
+  return index == 0 ? record.data.password : record.data.networks[index - 1].password;
+}
+
+bool Settings::update(char* field, size_t size, const char* value) {
+  if (strncmp(field, value, size - 1) == 0) return false;
+  strlcpy(field, value, size);
+  return true;
+}
+
+// Changes are collected until no setter was called for SETTINGS_COMMIT_DELAY,
+// every change folded into a pending commit saves one flash write
+void Settings::markDirty() {
+  if (dirty) Metrics::countSettingsCommitAvoided();
+  dirty = true;
+  changedAt = millis();
+}
+
+// The sequence only advances once the write succeeded, so a failed write is
+// retried on the same slot and never overwrites the last good record
+bool Settings::commit() {
+  Metrics::countSettingsCommit();
+  uint32_t sequence = record.sequence;
+  record.magic = SETTINGS_MAGIC;
+  record.version = SETTINGS_VERSION;
+  record.length = sizeof(SettingsData);
+  record.sequence = sequence + 1;
+  record.crc = crc32(&record.data, sizeof(SettingsData));
+  if (!writeBinaryFile(slots[record.sequence % 2], &record, sizeof(SettingsRecord))) {
+    record.sequence = sequence;
+    return false;
+  }
+  return true;
+}
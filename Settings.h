@@ -0,0 +1,89 @@
+#ifndef SETTINGS_H
+#define SETTINGS_H
+
+#include <cstddef>
+#include <cstdint>
+
+#define SETTINGS_SSID_SIZE 33
+#define SETTINGS_PASSWORD_SIZE 65
+#define SETTINGS_ROOM_NAME_SIZE 32
+#define SETTINGS_UPLOAD_URL_SIZE 96
+#define SETTINGS_NETWORK_COUNT 4
+
+struct KnownNetwork {
+  char ssid[SETTINGS_SSID_SIZE];
+  char password[SETTINGS_PASSWORD_SIZE];
+};
+
+struct StaticIpConfig {
+  uint32_t ip;
+  uint32_t gateway;
+  uint32_t subnet;
+  uint32_t dns;
+};
+
+// Fields may only ever be appended, older records are zero-extended when loaded.
+// ssid and password hold the first known network, bssid and channel belong to
+// the network at lastNetwork.
+struct SettingsData {
+  char ssid[SETTINGS_SSID_SIZE];
+  char password[SETTINGS_PASSWORD_SIZE];
+  char roomName[SETTINGS_ROOM_NAME_SIZE];
+  uint8_t weatherEnabled;
+  uint8_t bssid[6];
+  uint8_t channel;
+  StaticIpConfig staticIp;
+  uint8_t powerMode;
+  char uploadUrl[SETTINGS_UPLOAD_URL_SIZE];
+  KnownNetwork networks[SETTINGS_NETWORK_COUNT - 1];
+  uint8_t lastNetwork;
+};
+
+struct SettingsRecord {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t length;
+  uint32_t sequence;
+  uint32_t crc;
+  SettingsData data;
+};
+
+class Settings {
+  public:
+    static void begin();
+    static const char* getSsid(uint8_t index);
+    static const char* getPassword(uint8_t index);
+    static bool hasWiFi();
+    static bool hasWiFi(uint8_t index);
+    static uint8_t getLastNetwork();
+    static const char* getRoomName();
+    static bool isWeatherEnabled();
+    static const uint8_t* getBssid();
+    static uint8_t getChannel();
+    static const StaticIpConfig* getStaticIp();
+    static uint8_t getPowerMode();
+    static const char* getUploadUrl();
+    static bool setWiFi(uint8_t index, const char* ssid, const char* password);
+    static bool addWiFi(const char* ssid, const char* password);
+    static bool setRoomName(const char* roomName);
+    static bool setWeatherEnabled(bool enabled);
+    static bool setLastNetwork(uint8_t index, const uint8_t* bssid, uint8_t channel);
+    static bool setStaticIp(const StaticIpConfig* staticIp);
+    static bool setPowerMode(uint8_t powerMode);
+    static bool setUploadUrl(const char* uploadUrl);
+    static void loop();
+    static bool flush();
+  private:
+    static bool load(uint8_t slot, SettingsRecord* result);
+    static void migrate();
+    static bool commit();
+    static char* ssidField(uint8_t index);
+    static char* passwordField(uint8_t index);
+    static bool update(char* field, size_t size, const char* value);
+    static void markDirty();
+    static SettingsRecord record;
+    static bool dirty;
+    static uint32_t changedAt;
+};
+
+#endif
@@ -0,0 +1,30 @@
+#include "Upload.h"
+
+#include <Arduino.h>
+#include <ESP8266WiFi.h>
+#include "src/Mod_ESP8266HTTPClient.h"
+#include "Logging.h"
+
+// Only plain http:// URLs are supported, a TLS handshake would cost more
+// radio time than the upload itself
+bool upload(const char* url, const uint8_t* payload, size_t size, const char* contentType) {
+  if (strncmp_P(url, PSTR("http://"), 7) != 0) return false;
+  const char* host = url + 7;
+  const char* path = strchr(host, '/');
+  if (path == nullptr) path = host + strlen(host);
+  const char* portStart = (const char*) memchr(host, ':', path - host);
+  const char* hostEnd = portStart != nullptr ? portStart : path;
+  uint16_t port = portStart != nullptr ? atoi(portStart + 1) : 80;
+  if (hostEnd == host || port == 0) return false;
+
+  WiFiClient client;
+  HTTPClient http;
+  http.begin(client, String(host).substring(0, hostEnd - host), port, *path == '\0' ? String('/') : String(path), false);
+  int code = http.POST(payload, size, contentType);
+  http.end();
+  if (code < 200 || code >= 300) {
+    log("Upload failed");
+    return false;
+  }
+  return true;
+}
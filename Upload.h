@@ -0,0 +1,9 @@
+#ifndef UPLOAD_H
+#define UPLOAD_H
+
+#include <cstddef>
+#include <cstdint>
+
+bool upload(const char* url, const uint8_t* payload, size_t size, const char* contentType);
+
+#endif
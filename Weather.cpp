@@ -0,0 +1,268 @@
+#include "Weather.h"
+
+#include <Arduino.h>
+#include <lwip/dns.h>
+#include <lwip/tcp.h>
+#include "Metrics.h"
+#include "Logging.h"
+#include "Config.h"
+
+#define WEATHER_PORT 443
+#define WEATHER_CHUNK_SIZE 64
+
+// lwIP reads the name byte-wise, so it has to stay in RAM
+static const char weatherHost[] = "wttr.in";
+
+// HTTP/1.0 keeps the body free of chunked encoding
+static const char weatherRequest[] PROGMEM =
+  "GET /?T&format=%t+in+%l HTTP/1.0\r\n"
+  "Host: wttr.in\r\n"
+  "User-Agent: ESP8266HTTPClient\r\n"
+  "Connection: close\r\n"
+  "\r\n";
+
+// Written by the lwIP callback, answers to an abandoned lookup carry an older generation
+static volatile int8_t resolveResult = 0;
+static uint8_t resolveGeneration = 0;
+static ip_addr_t resolvedAddress;
+
+static void onResolved(const char* name, const ip_addr_t* address, void* generation) {
+  if ((uintptr_t) generation != resolveGeneration) return;
+  if (address != nullptr) resolvedAddress = *address;
+  resolveResult = address != nullptr ? 1 : -1;
+}
+
+// Written by the lwIP callbacks of the connection check, lwIP frees the
+// connection itself before reporting an error
+static volatile int8_t connectResult = 0;
+static struct tcp_pcb* connectPcb = nullptr;
+
+static err_t onConnected(void* arg, struct tcp_pcb* pcb, err_t err) {
+  connectResult = 1;
+  return ERR_OK;
+}
+
+static void onConnectError(void* arg, err_t err) {
+  connectPcb = nullptr;
+  if (connectResult == 0) connectResult = -1;
+}
+
+static bool startConnect() {
+  connectResult = 0;
+  connectPcb = tcp_new();
+  if (connectPcb == nullptr) return false;
+  tcp_err(connectPcb, onConnectError);
+  if (tcp_connect(connectPcb, &resolvedAddress, WEATHER_PORT, onConnected) == ERR_OK) return true;
+  tcp_abort(connectPcb);
+  connectPcb = nullptr;
+  return false;
+}
+
+static void stopConnect() {
+  if (connectPcb == nullptr) return;
+  tcp_err(connectPcb, nullptr);
+  if (tcp_close(connectPcb) != ERR_OK) tcp_abort(connectPcb);
+  connectPcb = nullptr;
+}
+
+weather_state_t Weather::state = WEATHER_IDLE;
+uint32_t Weather::stateSince = 0;
+WiFiClientSecure Weather::client;
+BearSSL::Session Weather::session;
+int8_t Weather::fragmentLengthSupported = -1;
+uint32_t Weather::heapBefore = 0;
+uint32_t Weather::heapMin = 0;
+char Weather::weather[WEATHER_SIZE] = "Unknown";
+char Weather::body[WEATHER_SIZE];
+char Weather::line[WEATHER_LINE_SIZE];
+uint8_t Weather::lineLength = 0;
+uint8_t Weather::bodyLength = 0;
+int Weather::statusCode = 0;
+int32_t Weather::contentLength = -1;
+int32_t Weather::received = 0;
+
+const char* Weather::get() {
+  return weather;
+}
+
+void Weather::update() {
+  if (state != WEATHER_IDLE || WiFi.status() != WL_CONNECTED) return;
+  resolveGeneration++;
+  resolveResult = 0;
+  err_t result = dns_gethostbyname(weatherHost, &resolvedAddress, onResolved, (void*) (uintptr_t) resolveGeneration);
+  if (result == ERR_OK) resolveResult = 1;
+  else if (result != ERR_INPROGRESS) {
+    log("Weather lookup failed");
+    return;
+  }
+  setState(WEATHER_RESOLVING);
+}
+
+void Weather::loop() {
+  if (state == WEATHER_IDLE) return;
+  uint32_t timeout = state == WEATHER_CONNECTING ? WEATHER_CONNECT_TIMEOUT : WEATHER_TIMEOUT;
+  if (millis() - stateSince >= timeout) {
+    log("Weather request timed out");
+    finish(false);
+    return;
+  }
+
+  if (state == WEATHER_RESOLVING) {
+    if (resolveResult == 0) return;
+    if (resolveResult < 0 || !startConnect()) {
+      log("Weather lookup failed");
+      finish(false);
+      return;
+    }
+    setState(WEATHER_CONNECTING);
+  } else if (state == WEATHER_CONNECTING) {
+    // The core's TLS client only connects blocking, so an unreachable server
+    // is found with a connection of our own first. Once it answered, the
+    // client's connect takes a single round trip.
+    if (connectResult == 0) return;
+    stopConnect();
+    if (connectResult < 0) {
+      log("Weather connection failed");
+      finish(false);
+      return;
+    }
+    setState(fragmentLengthSupported < 0 ? WEATHER_PROBING : WEATHER_HANDSHAKE);
+  } else if (state == WEATHER_PROBING) {
+    // Small buffers save about 16 KB of heap but only work if the server
+    // honours the max fragment length extension. The probe is a blocking
+    // connection of its own, so it gets a step of its own. It also answers
+    // no when it could not connect, so only a yes is final here, a no
+    // becomes final once the handshake after it succeeded.
+    if (WiFiClientSecure::probeMaxFragmentLength(IPAddress(&resolvedAddress), WEATHER_PORT, WEATHER_TLS_BUFFER_SIZE)) {
+      fragmentLengthSupported = 1;
+    }
+    setState(WEATHER_HANDSHAKE);
+  } else if (state == WEATHER_HANDSHAKE) {
+    // BearSSL itself is driven by whoever moves the bytes, but the core's
+    // WiFiClientSecure runs the whole handshake inside connect(). This step
+    // blocks for it, bounded by WEATHER_HANDSHAKE_TIMEOUT. The name is cached
+    // by now, connecting by name adds SNI without a lookup. The session from
+    // the previous fetch lets the server skip the key exchange.
+    if (fragmentLengthSupported > 0) client.setBufferSizes(WEATHER_TLS_BUFFER_SIZE, WEATHER_TLS_BUFFER_SIZE);
+    client.setInsecure();
+    client.setSession(&session);
+    client.setTimeout(WEATHER_HANDSHAKE_TIMEOUT);
+    heapBefore = ESP.getFreeHeap();
+    heapMin = heapBefore;
+    // A resumed session keeps its ID, a full handshake stores a new one
+    br_ssl_session_parameters* parameters = session.getSession();
+    uint8_t sessionId[sizeof(parameters->session_id)];
+    uint8_t sessionIdLength = parameters->session_id_len;
+    memcpy(sessionId, parameters->session_id, sessionIdLength);
+    uint32_t start = millis();
+    bool connected = client.connect(weatherHost, WEATHER_PORT);
+    bool resumed = connected && sessionIdLength > 0 && parameters->session_id_len == sessionIdLength
+      && memcmp(parameters->session_id, sessionId, sessionIdLength) == 0;
+    Metrics::countTlsHandshake(connected, resumed, millis() - start);
+    if (!connected) {
+      log("Weather handshake failed");
+      finish(false);
+      return;
+    }
+    if (fragmentLengthSupported < 0) fragmentLengthSupported = 0;
+    sampleHeap();
+    client.write_P(weatherRequest, strlen_P(weatherRequest));
+    lineLength = 0;
+    bodyLength = 0;
+    statusCode = 0;
+    contentLength = -1;
+    received = 0;
+    setState(WEATHER_HEADERS);
+  } else if (state == WEATHER_HEADERS) {
+    sampleHeap();
+    if (readHeaders()) setState(WEATHER_BODY);
+    else if (!client.connected()) {
+      log("Weather connection closed");
+      finish(false);
+    }
+  } else if (state == WEATHER_BODY) {
+    sampleHeap();
+    if (readBody()) finish(statusCode == 200);
+  }
+}
+
+void Weather::setState(weather_state_t next) {
+  state = next;
+  stateSince = millis();
+}
+
+// Only consumes what already arrived, returns true after the blank line that
+// ends the headers
+bool Weather::readHeaders() {
+  uint8_t chunk[WEATHER_CHUNK_SIZE];
+  while (client.available() > 0) {
+    int length = client.read(chunk, sizeof(chunk));
+    if (length <= 0) break;
+    for (int i = 0; i < length; i++) {
+      if (!parseHeader(chunk[i])) continue;
+      appendBody(chunk + i + 1, length - i - 1);
+      return true;
+    }
+  }
+  return false;
+}
+
+// Returns true once Content-Length bytes or everything up to the close arrived
+bool Weather::readBody() {
+  uint8_t chunk[WEATHER_CHUNK_SIZE];
+  while (client.available() > 0) {
+    int length = client.read(chunk, sizeof(chunk));
+    if (length <= 0) break;
+    appendBody(chunk, length);
+  }
+  if (contentLength >= 0 && received >= contentLength) return true;
+  return !client.connected() && client.available() == 0;
+}
+
+bool Weather::parseHeader(char c) {
+  if (c == '\r') return false;
+  if (c != '\n') {
+    if (lineLength < WEATHER_LINE_SIZE - 1) line[lineLength++] = c;
+    return false;
+  }
+  line[lineLength] = '\0';
+  bool end = lineLength == 0;
+  if (statusCode == 0) {
+    statusCode = lineLength > 9 && strncmp_P(line, PSTR("HTTP/1."), 7) == 0 ? atoi(line + 9) : -1;
+  } else if (strncasecmp_P(line, PSTR("Content-Length:"), 15) == 0) {
+    contentLength = atol(line + 15);
+  }
+  lineLength = 0;
+  return end;
+}
+
+// Anything beyond the summary size is dropped but still counted
+void Weather::appendBody(const uint8_t* data, size_t length) {
+  received += length;
+  size_t space = WEATHER_SIZE - 1 - bodyLength;
+  if (length > space) length = space;
+  memcpy(body + bodyLength, data, length);
+  bodyLength += length;
+}
+
+// The heap is only sampled between steps, allocations that are freed again
+// within the handshake are not seen
+void Weather::sampleHeap() {
+  uint32_t heapFree = ESP.getFreeHeap();
+  if (heapFree < heapMin) heapMin = heapFree;
+}
+
+void Weather::finish(bool success) {
+  body[bodyLength] = '\0';
+  if (success) strcpy(weather, body);
+  else if (bodyLength > 0) log(body);
+  if (heapBefore != 0) {
+    Metrics::countTlsHeap(heapBefore - heapMin);
+    heapBefore = 0;
+  }
+  // Stopping frees the TLS buffers, the session survives for the next fetch
+  stopConnect();
+  client.stop();
+  bodyLength = 0;
+  state = WEATHER_IDLE;
+}
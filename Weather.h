@@ -0,0 +1,55 @@
+#ifndef WEATHER_H
+#define WEATHER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <ESP8266WiFi.h>
+
+#define WEATHER_SIZE 64
+#define WEATHER_LINE_SIZE 64
+#define WEATHER_TLS_BUFFER_SIZE 512
+
+typedef enum {
+  WEATHER_IDLE,
+  WEATHER_RESOLVING,
+  WEATHER_CONNECTING,
+  WEATHER_PROBING,
+  WEATHER_HANDSHAKE,
+  WEATHER_HEADERS,
+  WEATHER_BODY
+} weather_state_t;
+
+// Fetches the weather summary in small steps driven by loop(), so the web
+// server keeps answering while the request is in flight. Only the TLS
+// handshake and the once-per-boot fragment length probe block.
+class Weather {
+  public:
+    static const char* get();
+    static void update();
+    static void loop();
+  private:
+    static void setState(weather_state_t next);
+    static bool readHeaders();
+    static bool readBody();
+    static bool parseHeader(char c);
+    static void appendBody(const uint8_t* data, size_t length);
+    static void sampleHeap();
+    static void finish(bool success);
+    static weather_state_t state;
+    static uint32_t stateSince;
+    static WiFiClientSecure client;
+    static BearSSL::Session session;
+    static int8_t fragmentLengthSupported;
+    static uint32_t heapBefore;
+    static uint32_t heapMin;
+    static char weather[WEATHER_SIZE];
+    static char body[WEATHER_SIZE];
+    static char line[WEATHER_LINE_SIZE];
+    static uint8_t lineLength;
+    static uint8_t bodyLength;
+    static int statusCode;
+    static int32_t contentLength;
+    static int32_t received;
+};
+
+#endif
@@ -0,0 +1,43 @@
+// Feeds malformed request bodies to JsonReader, built with AddressSanitizer so
+// a read past the end of a body fails the check
+//   make -C bench check
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "../Json.h"
+
+static int failures = 0;
+
+// Reads a flat object of string values the way the config handlers do
+static bool parse(const char* body) {
+  char* copy = strdup(body);
+  JsonReader json(copy);
+  char key[16];
+  char value[16];
+  bool valid = json.beginObject();
+  while (valid && json.nextKey(key, sizeof(key))) valid = json.readString(value, sizeof(value));
+  valid = valid && json.end();
+  free(copy);
+  return valid;
+}
+
+static void expect(const char* name, const char* body, bool valid) {
+  bool passed = parse(body) == valid;
+  if (!passed) failures++;
+  printf("%s %s\n", passed ? "ok  " : "FAIL", name);
+}
+
+int main() {
+  expect("Valid object", "{\"a\":\"b\\\"\\u00e9\"}", true);
+  expect("Backslash at the end of a key", "{\"\\", false);
+  expect("Backslash at the end of a value", "{\"a\":\"\\", false);
+  expect("Unterminated key", "{\"abc", false);
+  expect("Unterminated value", "{\"a\":\"bc", false);
+  expect("Truncated unicode escape", "{\"a\":\"\\u00", false);
+  expect("Unknown escape", "{\"a\":\"\\x\"}", false);
+  expect("Missing colon", "{\"a\" \"b\"}", false);
+  expect("Unclosed object", "{\"a\":\"b\"", false);
+  expect("Trailing data", "{\"a\":\"b\"} x", false);
+  return failures > 0;
+}
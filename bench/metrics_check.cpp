@@ -0,0 +1,110 @@
+// Renders /metrics with every value at its widest and checks that each line
+// is complete and in the text exposition format
+//   make -C bench && ./bench/metrics_check
+
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <Arduino.h>
+#include <ESP.h>
+#include <StackThunk.h>
+#include "../Metrics.h"
+#include "../Power.h"
+#include "../src/Mod_ESP8266Ping.h"
+
+EspClass ESP;
+ESP8266WiFiClass WiFi;
+PingClass Ping;
+
+uint32_t millis() { return UINT32_MAX; }
+void EspClass::getHeapStats(uint32_t* free, uint16_t* maxBlock, uint8_t* fragmentation) {
+  if (free) *free = UINT32_MAX;
+  if (maxBlock) *maxBlock = UINT16_MAX;
+  if (fragmentation) *fragmentation = 100;
+}
+uint32_t EspClass::getCycleCount() { return 0; }
+uint8_t EspClass::getCpuFreqMHz() { return 160; }
+uint8_t ESP8266WiFiClass::status() { return WL_CONNECTED; }
+uint32_t stack_thunk_get_max_usage() { return UINT32_MAX; }
+
+PingClass::PingClass() {}
+uint32_t PingClass::lost() { return UINT32_MAX / 2; }
+uint32_t PingClass::completed() { return UINT32_MAX; }
+uint8_t PingClass::consecutiveLost() { return UINT8_MAX; }
+uint8_t PingClass::lostInHistory() { return PING_HISTORY_SIZE; }
+int PingClass::minTime() { return 999999; }
+int PingClass::maxTime() { return 999999; }
+int PingClass::averageTime() { return 999999; }
+int PingClass::jitter() { return 999999; }
+
+power_mode_t Power::getMode() { return POWER_LIGHT_SLEEP; }
+uint32_t Power::getCycles() { return UINT32_MAX; }
+uint32_t Power::getLastAwakeTime() { return UINT32_MAX; }
+uint32_t Power::getSampleEnergy() { return UINT32_MAX; }
+const char* Power::getModeName(power_mode_t) { return "light-sleep"; }
+
+static int failures = 0;
+
+static void fail(const char* message, const std::string& line) {
+  failures++;
+  printf("FAIL %s: %s\n", message, line.c_str());
+}
+
+// name{labels} value, the labels are not parsed any further
+static bool isSample(const std::string& line) {
+  size_t i = 0;
+  while (i < line.size() && (islower(line[i]) || line[i] == '_')) i++;
+  if (i == 0) return false;
+  if (i < line.size() && line[i] == '{') {
+    i = line.find("} ", i);
+    if (i == std::string::npos) return false;
+    i++;
+  }
+  if (i >= line.size() || line[i] != ' ' || i + 1 == line.size()) return false;
+  for (i++; i < line.size(); i++) {
+    if (!isdigit(line[i]) && line[i] != '.') return false;
+  }
+  return true;
+}
+
+int main() {
+  Metrics::track(F("/a-rather-long-path/that/fills/the/labels"), HTTP_GET, []() {})();
+  Metrics::countReconnect(UINT32_MAX);
+  Metrics::countTlsHandshake(true, false, UINT32_MAX);
+
+  ESP8266WebServer server;
+  Metrics::print(&server);
+  const std::string& body = server.body;
+  if (body.empty() || body.back() != '\n') fail("Response does not end with a newline", body.substr(body.rfind('\n') + 1));
+
+  size_t lines = 0;
+  size_t start = 0;
+  size_t end;
+  while ((end = body.find('\n', start)) != std::string::npos) {
+    std::string line = body.substr(start, end - start);
+    start = end + 1;
+    lines++;
+    if (line.compare(0, 7, "# TYPE ") == 0) {
+      if (line.find('#', 1) != std::string::npos) fail("Broken TYPE line", line);
+    } else if (!isSample(line)) {
+      fail("Broken sample", line);
+    }
+  }
+
+  static const char* required[] = {
+    "simplehome_http_rate_limited_total ",
+    "simplehome_heap_fragmentation_percent ",
+    "simplehome_wifi_reconnects_total ",
+    "simplehome_wifi_downtime_seconds_total ",
+    "simplehome_boot_first_request_seconds ",
+    "simplehome_uptime_seconds ",
+    "simplehome_tls_stack_peak_bytes "
+  };
+  for (const char* name : required) {
+    if (body.find(std::string("\n") + name) == std::string::npos) fail("Missing sample", name);
+  }
+
+  printf("%zu lines, %zu bytes, %d failures\n", lines, body.size(), failures);
+  return failures > 0;
+}
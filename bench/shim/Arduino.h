@@ -0,0 +1,36 @@
+// Just enough of the Arduino core to build the pure modules on the host,
+// flash and RAM are the same address space there
+#ifndef ARDUINO_H
+#define ARDUINO_H
+
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#define PROGMEM
+#define PSTR(s) (s)
+#define F(s) ((const __FlashStringHelper*) (s))
+#define strlen_P strlen
+#define memcpy_P memcpy
+#define snprintf_P snprintf
+#define pgm_read_byte(p) (*(const uint8_t*) (p))
+#define pgm_read_dword(p) (*(const uint32_t*) (p))
+
+typedef const char* PGM_P;
+class __FlashStringHelper;
+
+// %S prints a flash string on the ESP8266 but a wide string on the host
+static inline int vsnprintf_P(char* buffer, size_t size, PGM_P format, va_list args) {
+  char hostFormat[strlen(format) + 1];
+  strcpy(hostFormat, format);
+  for (char* c = hostFormat; *c != '\0'; c++) {
+    if (c[0] == '%' && c[1] == 'S') c[1] = 's';
+  }
+  return vsnprintf(buffer, size, hostFormat, args);
+}
+
+uint32_t millis();
+
+#endif
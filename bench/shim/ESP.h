@@ -0,0 +1,15 @@
+#ifndef ESP_H
+#define ESP_H
+
+#include <cstdint>
+
+class EspClass {
+  public:
+    void getHeapStats(uint32_t* free, uint16_t* maxBlock, uint8_t* fragmentation);
+    uint32_t getCycleCount();
+    uint8_t getCpuFreqMHz();
+};
+
+extern EspClass ESP;
+
+#endif
@@ -0,0 +1,18 @@
+#ifndef ESP8266WEBSERVER_H
+#define ESP8266WEBSERVER_H
+
+#include <functional>
+#include <string>
+#include <Arduino.h>
+
+enum HTTPMethod { HTTP_ANY, HTTP_GET, HTTP_HEAD, HTTP_POST, HTTP_PUT, HTTP_PATCH, HTTP_DELETE, HTTP_OPTIONS };
+
+// Collects the response body instead of sending it
+class ESP8266WebServer {
+  public:
+    typedef std::function<void(void)> THandlerFunction;
+    void sendContent(const char* content, size_t length) { body.append(content, length); }
+    std::string body;
+};
+
+#endif
@@ -0,0 +1,17 @@
+#ifndef ESP8266WIFI_H
+#define ESP8266WIFI_H
+
+#include <cstdint>
+
+#define WL_CONNECTED 3
+
+class IPAddress {};
+
+class ESP8266WiFiClass {
+  public:
+    uint8_t status();
+};
+
+extern ESP8266WiFiClass WiFi;
+
+#endif
@@ -0,0 +1,8 @@
+#ifndef STACKTHUNK_H
+#define STACKTHUNK_H
+
+#include <cstdint>
+
+uint32_t stack_thunk_get_max_usage();
+
+#endif
@@ -0,0 +1 @@
+struct ping_option {};
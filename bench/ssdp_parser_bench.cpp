@@ -0,0 +1,99 @@
+// Checks the M-SEARCH matching rules, then measures parseSSDPSearch()
+// throughput over the captures in ssdp_corpus
+//   make -C bench && ./bench/ssdp_parser_bench bench/ssdp_corpus/*.txt
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "../src/Mod_ESP8266SSDPParser.h"
+
+#define ITERATIONS 200000
+
+static const char* uuid = "uuid:38323636-4558-4dda-9188-cda0e6a1b2c3";
+static int failures = 0;
+
+static void expect(const char* name, const char* packet, const char* deviceType, bool valid, ssdp_search_match_t match, uint8_t mx) {
+  SSDPSearch search;
+  bool result = parseSSDPSearch(packet, strlen(packet), deviceType, uuid, &search);
+  bool passed = result == valid && (!valid || (search.match == match && search.mx == mx));
+  if (!passed) failures++;
+  printf("%s %s\n", passed ? "ok  " : "FAIL", name);
+}
+
+static void check() {
+  const char* basic2 = "urn:schemas-upnp-org:device:Basic:2";
+  expect("ST version downgrade matches",
+    "M-SEARCH * HTTP/1.1\r\nMAN: \"ssdp:discover\"\r\nMX: 1\r\nST: urn:schemas-upnp-org:device:Basic:1\r\n\r\n",
+    basic2, true, SSDP_SEARCH_DEVICE_TYPE, 1);
+  expect("ST higher version is ignored",
+    "M-SEARCH * HTTP/1.1\r\nMAN: \"ssdp:discover\"\r\nMX: 1\r\nST: urn:schemas-upnp-org:device:Basic:3\r\n\r\n",
+    basic2, false, SSDP_SEARCH_IGNORE, 0);
+  expect("ST other type is ignored",
+    "M-SEARCH * HTTP/1.1\r\nMAN: \"ssdp:discover\"\r\nMX: 1\r\nST: urn:schemas-upnp-org:device:Light:1\r\n\r\n",
+    basic2, false, SSDP_SEARCH_IGNORE, 0);
+  expect("MX is capped",
+    "M-SEARCH * HTTP/1.1\r\nMAN: \"ssdp:discover\"\r\nMX: 120\r\nST: ssdp:all\r\n\r\n",
+    "upnp:rootdevice", true, SSDP_SEARCH_ALL, SSDP_MX_MAX);
+  expect("MX with many digits is capped",
+    "M-SEARCH * HTTP/1.1\r\nMAN: \"ssdp:discover\"\r\nMX: 00000000000000000000120\r\nST: ssdp:all\r\n\r\n",
+    "upnp:rootdevice", true, SSDP_SEARCH_ALL, SSDP_MX_MAX);
+  expect("MX beyond any integer is capped",
+    "M-SEARCH * HTTP/1.1\r\nMAN: \"ssdp:discover\"\r\nMX: 99999999999999999999999\r\nST: ssdp:all\r\n\r\n",
+    "upnp:rootdevice", true, SSDP_SEARCH_ALL, SSDP_MX_MAX);
+  expect("Invalid MX is rejected",
+    "M-SEARCH * HTTP/1.1\r\nMAN: \"ssdp:discover\"\r\nMX: abc\r\nST: ssdp:all\r\n\r\n",
+    "upnp:rootdevice", false, SSDP_SEARCH_IGNORE, 0);
+  expect("Negative MX is rejected",
+    "M-SEARCH * HTTP/1.1\r\nMAN: \"ssdp:discover\"\r\nMX: -1\r\nST: ssdp:all\r\n\r\n",
+    "upnp:rootdevice", false, SSDP_SEARCH_IGNORE, 0);
+  expect("Mixed-case MAN header matches",
+    "M-SEARCH * HTTP/1.1\r\nmAn: \"SSDP:Discover\"\r\nMX: 2\r\nST: upnp:rootdevice\r\n\r\n",
+    "upnp:rootdevice", true, SSDP_SEARCH_DEVICE_TYPE, 2);
+  expect("Missing MAN is ignored",
+    "M-SEARCH * HTTP/1.1\r\nMX: 2\r\nST: upnp:rootdevice\r\n\r\n",
+    "upnp:rootdevice", false, SSDP_SEARCH_IGNORE, 0);
+  expect("UUID search matches",
+    "M-SEARCH * HTTP/1.1\r\nMAN: \"ssdp:discover\"\r\nMX: 1\r\nST: uuid:38323636-4558-4dda-9188-cda0e6a1b2c3\r\n\r\n",
+    "upnp:rootdevice", true, SSDP_SEARCH_UUID, 1);
+}
+
+static bool load(const char* path, std::string* packet) {
+  FILE* file = fopen(path, "rb");
+  if (!file) return false;
+  char buffer[512];
+  size_t length;
+  while ((length = fread(buffer, 1, sizeof(buffer), file)) > 0) packet->append(buffer, length);
+  fclose(file);
+  return true;
+}
+
+int main(int argc, char** argv) {
+  check();
+
+  std::vector<std::string> corpus;
+  for (int i = 1; i < argc; i++) {
+    std::string packet;
+    if (!load(argv[i], &packet)) {
+      fprintf(stderr, "Cannot read %s\n", argv[i]);
+      return 1;
+    }
+    corpus.push_back(packet);
+  }
+  if (corpus.empty()) return failures > 0;
+
+  uint32_t answered = 0;
+  SSDPSearch search;
+  auto start = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < ITERATIONS; i++) {
+    for (const std::string& packet : corpus) {
+      answered += parseSSDPSearch(packet.data(), packet.size(), "upnp:rootdevice", uuid, &search);
+    }
+  }
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  double packets = (double) ITERATIONS * corpus.size();
+  printf("%zu captures, %u of %zu answered, %.0f packets/s, %.1f ns/packet\n",
+    corpus.size(), answered / ITERATIONS, corpus.size(), packets / seconds, seconds * 1e9 / packets);
+  return failures > 0;
+}
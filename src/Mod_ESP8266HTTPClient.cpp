@@ -149,12 +149,27 @@ int HTTPClient::GET()
     return sendRequest("GET");
 }
 
+/**
+ * sends a post request to the server
+ * @param payload const uint8_t *
+ * @param size size_t
+ * @param contentType const char *
+ * @return http code
+ */
+int HTTPClient::POST(const uint8_t* payload, size_t size, const char* contentType)
+{
+    return sendRequest("POST", payload, size, contentType);
+}
+
 /**
  * sendRequest
  * @param type const char *           "GET", "POST", ....
+ * @param payload const uint8_t *      data for the message body
+ * @param size size_t                  size for the message body if 0 not send
+ * @param contentType const char *     Content-Type of the message body
  * @return -1 if no info or > 0 when Content-Length is set by server
  */
-int HTTPClient::sendRequest(const char * type)
+int HTTPClient::sendRequest(const char * type, const uint8_t * payload, size_t size, const char * contentType)
 {
     int code;
 
@@ -166,10 +181,17 @@ int HTTPClient::sendRequest(const char * type)
     }
 
     // send Header
-    if(!sendHeader(type)) {
+    if(!sendHeader(type, size, contentType)) {
         return returnError(HTTPC_ERROR_SEND_HEADER_FAILED);
     }
 
+    // send Payload if needed
+    if(payload && size > 0) {
+        if(_client->write(payload, size) != size) {
+            return returnError(HTTPC_ERROR_SEND_PAYLOAD_FAILED);
+        }
+    }
+
     // handle Server Response (Header)
     code = handleHeaderResponse();
 
@@ -321,7 +343,7 @@ bool HTTPClient::connect(void)
  * @param type (GET, POST, ...)
  * @return status
  */
-bool HTTPClient::sendHeader(const char * type)
+bool HTTPClient::sendHeader(const char * type, size_t size, const char * contentType)
 {
     if(!connected()) {
         return false;
@@ -350,6 +372,15 @@ bool HTTPClient::sendHeader(const char * type)
     header += F("\r\nUser-Agent: ");
     header += _userAgent;
 
+    if (size > 0) {
+        header += F("\r\nContent-Length: ");
+        header += String(size);
+        if (contentType) {
+            header += F("\r\nContent-Type: ");
+            header += contentType;
+        }
+    }
+
     header += F(
       "\r\nAccept-Encoding: identity;q=1,chunked;q=0.1,*;q=0"
       "\r\nConnection: close"
@@ -85,7 +85,8 @@ public:
 
     /// request handling
     int GET();
-    int sendRequest(const char* type);
+    int POST(const uint8_t* payload, size_t size, const char* contentType);
+    int sendRequest(const char* type, const uint8_t* payload = NULL, size_t size = 0, const char* contentType = NULL);
 
     int writeToStream(Stream* stream);
     const String& getString(void);
@@ -100,7 +101,7 @@ protected:
     void clear();
     int returnError(int error);
     bool connect(void);
-    bool sendHeader(const char * type);
+    bool sendHeader(const char * type, size_t size, const char* contentType);
     int handleHeaderResponse();
 
     WiFiClient* _client;
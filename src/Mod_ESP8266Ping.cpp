@@ -0,0 +1,165 @@
+/*
+  ESP8266Ping - Ping library for ESP8266
+  Copyright (c) 2015 Daniele Colanardi. All rights reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "Mod_ESP8266Ping.h"
+
+PingClass::PingClass() {}
+
+bool PingClass::start(IPAddress dest) {
+    if (_running) return false;
+
+    memset(&_options, 0, sizeof(struct ping_option));
+
+    // Repeat count (how many time send a ping message to destination)
+    _options.count = 1;
+    // Time interval between two ping (seconds??)
+    _options.coarse_time = 1;
+    // Destination machine
+    _options.ip = dest;
+
+    // Callbacks
+    _options.recv_function = reinterpret_cast<ping_recv_function>(&PingClass::_ping_recv_cb);
+    _options.sent_function = NULL;
+
+    // Let's go! The result arrives in the callback, the caller is not suspended
+    _running = ping_start(&_options);
+    if (_running) _sent++;
+    return _running;
+}
+
+bool PingClass::running() {
+    return _running;
+}
+
+uint32_t PingClass::sent() {
+    return _sent;
+}
+
+uint32_t PingClass::lost() {
+    return _lost;
+}
+
+uint32_t PingClass::completed() {
+    return _completed;
+}
+
+uint8_t PingClass::consecutiveLost() {
+    return _consecutive_lost;
+}
+
+int PingClass::minTime() {
+    int result = -1;
+    for (uint8_t i = 0; i < _history_count; i++) {
+        if (_history[i] >= 0 && (result < 0 || _history[i] < result)) result = _history[i];
+    }
+    return result;
+}
+
+int PingClass::maxTime() {
+    int result = -1;
+    for (uint8_t i = 0; i < _history_count; i++) {
+        if (_history[i] > result) result = _history[i];
+    }
+    return result;
+}
+
+int PingClass::averageTime() {
+    int sum = 0;
+    int count = 0;
+    for (uint8_t i = 0; i < _history_count; i++) {
+        if (_history[i] < 0) continue;
+        sum += _history[i];
+        count++;
+    }
+    return count > 0 ? sum / count : -1;
+}
+
+int PingClass::jitter() {
+    // Mean difference between consecutive replies, oldest sample first
+    int sum = 0;
+    int count = 0;
+    int previous = -1;
+    uint8_t first = _history_count < PING_HISTORY_SIZE ? 0 : _history_index;
+    for (uint8_t i = 0; i < _history_count; i++) {
+        int time = _history[(first + i) % PING_HISTORY_SIZE];
+        if (time < 0) continue;
+        if (previous >= 0) {
+            sum += abs(time - previous);
+            count++;
+        }
+        previous = time;
+    }
+    return count > 0 ? sum / count : -1;
+}
+
+uint8_t PingClass::lostInHistory() {
+    uint8_t result = 0;
+    for (uint8_t i = 0; i < _history_count; i++) {
+        if (_history[i] < 0) result++;
+    }
+    return result;
+}
+
+void PingClass::_ping_recv_cb(void *opt, void *resp) {
+    // Cast the parameters to get some usable info
+    ping_resp*   ping_resp = reinterpret_cast<struct ping_resp*>(resp);
+
+    // Error or success?
+    bool success = ping_resp->ping_err != -1;
+    _history[_history_index] = success ? (int16_t) ping_resp->resp_time : -1;
+    _history_index = (_history_index + 1) % PING_HISTORY_SIZE;
+    if (_history_count < PING_HISTORY_SIZE) _history_count++;
+    if (success) {
+        _consecutive_lost = 0;
+    } else {
+        _lost++;
+        if (_consecutive_lost < UINT8_MAX) _consecutive_lost++;
+    }
+
+    // Some debug info
+    DEBUG_PING(
+            "DEBUG: ping reply\n"
+            "\ttotal_count = %d \n"
+            "\tresp_time = %d \n"
+            "\tseqno = %d \n"
+            "\ttimeout_count = %d \n"
+            "\tbytes = %d \n"
+            "\ttotal_bytes = %d \n"
+            "\ttotal_time = %d \n"
+            "\tping_err = %d \n",
+            ping_resp->total_count, ping_resp->resp_time, ping_resp->seqno,
+            ping_resp->timeout_count, ping_resp->bytes, ping_resp->total_bytes,
+            ping_resp->total_time, ping_resp->ping_err
+    );
+
+    // Only one echo is requested, so the first reply or timeout ends the ping
+    _completed++;
+    _running = false;
+}
+
+volatile bool PingClass::_running = false;
+int16_t PingClass::_history[PING_HISTORY_SIZE];
+uint8_t PingClass::_history_index = 0;
+uint8_t PingClass::_history_count = 0;
+uint32_t PingClass::_sent = 0;
+uint32_t PingClass::_lost = 0;
+uint32_t PingClass::_completed = 0;
+uint8_t PingClass::_consecutive_lost = 0;
+
+PingClass Ping;
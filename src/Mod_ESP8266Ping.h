@@ -22,6 +22,7 @@
 
 #include <Arduino.h>
 #include <ESP8266WiFi.h>
+#include "../Config.h"
 
 extern "C" {
   #include <ping.h>
@@ -33,18 +34,35 @@ extern "C" {
   #define DEBUG_PING(...)
 #endif
 
+#define PING_HISTORY_SIZE 16
+
 class PingClass {
   public:
     PingClass();
-    bool ping(IPAddress dest);
-    bool ping(const char* host);
+    bool start(IPAddress dest);
+    bool running();
+    uint32_t sent();
+    uint32_t lost();
+    uint32_t completed();
+    uint8_t consecutiveLost();
+    uint8_t lostInHistory();
+    int minTime();
+    int maxTime();
+    int averageTime();
+    int jitter();
   protected:
     static void _ping_recv_cb(void *opt, void *pdata);
     ping_option _options;
-    static bool _success;
+    static volatile bool _running;
+    static int16_t _history[PING_HISTORY_SIZE];
+    static uint8_t _history_index;
+    static uint8_t _history_count;
+    static uint32_t _sent;
+    static uint32_t _lost;
+    static uint32_t _completed;
+    static uint8_t _consecutive_lost;
 };
 
-#include "Mod_ESP8266Ping.impl.h"
-PingClass Ping;
+extern PingClass Ping;
 
 #endif
@@ -30,6 +30,7 @@ License (MIT license):
 #endif
 #include <functional>
 #include "Mod_ESP8266SSDP.h"
+#include "Mod_ESP8266SSDPParser.h"
 #include "WiFiUdp.h"
 #include "debug.h"
 
@@ -45,12 +46,11 @@ extern "C" {
 #include "lwip/igmp.h"
 #include "lwip/mem.h"
 #include "include/UdpContext.h"
+#include <coredecls.h>
 //#define DEBUG_SSDP  Serial
 
 #define SSDP_PORT         1900
-#define SSDP_METHOD_SIZE  10
-#define SSDP_URI_SIZE     2
-#define SSDP_BUFFER_SIZE  64
+#define SSDP_PACKET_SIZE  512
 
 // ssdp ipv6 is FF05::C
 // lwip-v2's igmp_joingroup only supports IPv4
@@ -65,21 +65,32 @@ static const char _ssdp_notify_template[] PROGMEM =
   "HOST: 239.255.255.250:1900\r\n"
   "NTS: ssdp:alive\r\n";
 
+static const char _ssdp_byebye_template[] PROGMEM =
+  "NOTIFY * HTTP/1.1\r\n"
+  "HOST: 239.255.255.250:1900\r\n"
+  "NTS: ssdp:byebye\r\n"
+  "NT: %S\r\n" // deviceType
+  "USN: %s\r\n" // uuid
+  "\r\n";
+
 static const char _ssdp_packet_template[] PROGMEM =
   "%s" // _ssdp_response_template / _ssdp_notify_template
   "CACHE-CONTROL: max-age=%u\r\n" // interval
-  "SERVER: Arduino/1.0 UPNP/1.1 %s/%s\r\n" // modelName, modelNumber
+  "SERVER: Arduino/1.0 UPNP/1.1 %S/%S\r\n" // modelName, modelNumber
   "USN: %s\r\n" // uuid
-  "%s: %s\r\n"  // "NT" or "ST", deviceType
-  "LOCATION: http://%s:%u/%s\r\n" // WiFi.localIP(), port, schemaURL
+  "%s: %S\r\n"  // "NT" or "ST", deviceType
+  "LOCATION: http://%s:%u/%S\r\n" // WiFi.localIP(), port, schemaURL
   "\r\n";
 
-static const char _ssdp_schema_template[] PROGMEM =
+static const char _ssdp_schema_header[] PROGMEM =
   "HTTP/1.1 200 OK\r\n"
   "Content-Type: text/xml\r\n"
+  "Content-Length: %u\r\n"
   "Connection: close\r\n"
   "Access-Control-Allow-Origin: *\r\n"
-  "\r\n"
+  "\r\n";
+
+static const char _ssdp_schema_template[] PROGMEM =
   "<?xml version=\"1.0\"?>"
   "<root xmlns=\"urn:schemas-upnp-org:device-1-0\">"
   "<specVersion>"
@@ -88,15 +99,15 @@ static const char _ssdp_schema_template[] PROGMEM =
   "</specVersion>"
   "<URLBase>http://%s:%u/</URLBase>" // WiFi.localIP(), port
   "<device>"
-  "<deviceType>%s</deviceType>"
+  "<deviceType>%S</deviceType>"
   "<friendlyName>%s</friendlyName>"
-  "<presentationURL>%s</presentationURL>"
+  "<presentationURL>%S</presentationURL>"
   "<serialNumber>%s</serialNumber>"
-  "<modelName>%s</modelName>"
-  "<modelNumber>%s</modelNumber>"
-  "<modelURL>%s</modelURL>"
-  "<manufacturer>%s</manufacturer>"
-  "<manufacturerURL>%s</manufacturerURL>"
+  "<modelName>%S</modelName>"
+  "<modelNumber>%S</modelNumber>"
+  "<modelURL>%S</modelURL>"
+  "<manufacturer>%S</manufacturer>"
+  "<manufacturerURL>%S</manufacturerURL>"
   "<UDN>%s</UDN>"
   "</device>"
  //"<iconList>"
@@ -123,32 +134,63 @@ struct SSDPTimer {
   ETSTimer timer;
 };
 
-SSDPClass::SSDPClass()
-:  _respondToAddr(0,0,0,0)
-{
+static const char _ssdp_empty[] PROGMEM = "";
+static const char _ssdp_default_device_type[] PROGMEM = "urn:schemas-upnp-org:device:Basic:1";
+static const char _ssdp_default_schema_url[] PROGMEM = "ssdp/schema.xml";
+
+SSDPClass::SSDPClass() {
   uuid[0] = '\0';
-  modelNumber[0] = '\0';
-  strcpy(deviceType, "urn:schemas-upnp-org:device:Basic:1");
+  modelNumber = _ssdp_empty;
+  deviceType = _ssdp_default_device_type;
   friendlyName[0] = '\0';
-  presentationURL[0] = '\0';
+  presentationURL = _ssdp_empty;
   serialNumber[0] = '\0';
-  modelName[0] = '\0';
-  modelURL[0] = '\0';
-  manufacturer[0] = '\0';
-  manufacturerURL[0] = '\0';
-  strcpy(schemaURL, "ssdp/schema.xml");
+  modelName = _ssdp_empty;
+  modelURL = _ssdp_empty;
+  manufacturer = _ssdp_empty;
+  manufacturerURL = _ssdp_empty;
+  schemaURL = _ssdp_default_schema_url;
 }
 
 SSDPClass::~SSDPClass() {
   end();
+  invalidateSchema();
 }
 
-bool SSDPClass::begin() {
-  end();
+// Has to be called after changing interval or any of the descriptor strings while running
+void SSDPClass::invalidate() {
+  _invalidatePackets();
+  invalidateSchema();
+}
+
+// The packets carry the address, so they are dropped on every restart while
+// the description survives until a descriptor string changes
+void SSDPClass::_invalidatePackets() {
+  for (uint8_t i = 0; i < SSDP_PACKET_COUNT; i++) {
+    free(_packets[i]);
+    _packets[i] = nullptr;
+  }
+}
 
-  _pending = false;
-  _st_is_uuid = false;
+// Enough after changing a string only the description carries, the ETag is
+// computed again from the new content
+void SSDPClass::invalidateSchema() {
+  free(_schema);
+  _schema = nullptr;
+}
+
+bool SSDPClass::begin() {
+  // Restarting on the announced address goes straight to the alive burst,
+  // only a device that moved says goodbye for its old address first
+  _stop(_announcedAddr != 0 && _announcedAddr != WiFi.localIP().v4());
+
+  for (uint8_t i = 0; i < SSDP_QUEUE_SIZE; i++) _queue[i].port = 0;
+  // Control points may still cache the previous address, announce right away
+  _notify_time = 0;
+  _burst = SSDP_BURST_COUNT;
+  _invalidatePackets();
   if (strcmp(uuid,"") == 0) {
+    invalidateSchema();
   	uint32_t chipId = ESP.getChipId();
   	sprintf_P(uuid, PSTR("uuid:38323636-4558-4dda-9188-cda0e6%02x%02x%02x"),
     (uint16_t) ((chipId >> 16) & 0xff),
@@ -192,6 +234,10 @@ bool SSDPClass::begin() {
 }
 
 void SSDPClass::end() {
+  _stop(true);
+}
+
+void SSDPClass::_stop(bool byebye) {
   if(!_server)
     return; // object is zeroed already, nothing to do
 
@@ -201,6 +247,10 @@ void SSDPClass::end() {
   // undo all initializations done in begin(), in reverse order
   _stopTimer();
 
+  if (byebye && _announcedAddr != 0 && WiFi.isConnected())
+    _send(SSDP_PACKET_BYEBYE);
+  _announcedAddr = 0;
+
   _server->disconnect();
 
   IPAddress local = WiFi.localIP();
@@ -214,37 +264,65 @@ void SSDPClass::end() {
 
   _server->unref();
   _server = 0;
+  _invalidatePackets();
 
 #ifdef DEBUG_SSDP
     DEBUG_SSDP.printf_P(PSTR("ok\n"));
 #endif
 }
-void SSDPClass::_send(ssdp_method_t method) {
-  char buffer[1460];
+
+// The packets only depend on the address, the port and the descriptor, so
+// they are rendered once and reused until one of those changes
+bool SSDPClass::_preparePackets() {
   IPAddress ip = WiFi.localIP();
+  if (_packets[0] && _packetAddr == ip.v4() && _packetPort == port) return true;
+  _invalidatePackets();
 
+  String address = ip.toString();
   char valueBuffer[strlen_P(_ssdp_notify_template) + 1];
-  strcpy_P(valueBuffer, (method == NONE) ? _ssdp_response_template : _ssdp_notify_template);
-
-  int len = snprintf_P(buffer, sizeof(buffer),
-                       _ssdp_packet_template,
-                       valueBuffer,
-                       interval,
-                       modelName,
-                       modelNumber,
-                       uuid,
-                       (method == NONE) ? "ST" : "NT",
-                       (_st_is_uuid) ? uuid : deviceType,
-                       ip.toString().c_str(), port, schemaURL
-                      );
-
-  _server->append(buffer, len);
+  for (uint8_t i = 0; i < SSDP_PACKET_COUNT; i++) {
+    bool notify = i == SSDP_PACKET_NOTIFY;
+    strcpy_P(valueBuffer, notify ? _ssdp_notify_template : _ssdp_response_template);
+    for (uint8_t pass = 0; pass < 2; pass++) {
+      size_t size = _packets[i] ? _packetLengths[i] + 1 : 0;
+      int len = (i == SSDP_PACKET_BYEBYE)
+                ? snprintf_P(_packets[i], size, _ssdp_byebye_template, deviceType, uuid)
+                : snprintf_P(_packets[i], size,
+                             _ssdp_packet_template,
+                             valueBuffer,
+                             interval,
+                             modelName,
+                             modelNumber,
+                             uuid,
+                             notify ? "NT" : "ST",
+                             (i == SSDP_PACKET_RESPONSE_UUID) ? uuid : deviceType,
+                             address.c_str(), port, schemaURL
+                            );
+      if (pass == 0) {
+        _packetLengths[i] = len;
+        _packets[i] = (char*) malloc(len + 1);
+        if (!_packets[i]) {
+          _invalidatePackets();
+          return false;
+        }
+      }
+    }
+  }
+  _packetAddr = ip.v4();
+  _packetPort = port;
+  return true;
+}
+
+// Responses go to the requester of the queue entry, everything else is multicast
+void SSDPClass::_send(ssdp_packet_t packet, const SSDPResponse* response) {
+  if (!_preparePackets()) return;
+  _server->append(_packets[packet], _packetLengths[packet]);
 
   IPAddress remoteAddr;
   uint16_t remotePort;
-  if (method == NONE) {
-    remoteAddr = _respondToAddr;
-    remotePort = _respondToPort;
+  if (response) {
+    remoteAddr = response->addr;
+    remotePort = response->port;
 #ifdef DEBUG_SSDP
     DEBUG_SSDP.print("Sending Response to ");
 #endif
@@ -264,169 +342,129 @@ void SSDPClass::_send(ssdp_method_t method) {
   _server->send(remoteAddr, remotePort);
 }
 
-void SSDPClass::schema(Print &client) const {
+// The description is rendered once per address and reused for every fetch,
+// its ETag lets control points revalidate without downloading it again
+const char* SSDPClass::schemaDocument(size_t* length, uint32_t* etag) {
   IPAddress ip = WiFi.localIP();
-  char buffer[strlen_P(_ssdp_schema_template) + 1];
-  strcpy_P(buffer, _ssdp_schema_template);
-  client.printf(buffer,
-                ip.toString().c_str(), port,
-                deviceType,
-                friendlyName,
-                presentationURL,
-                serialNumber,
-                modelName,
-                modelNumber,
-                modelURL,
-                manufacturer,
-                manufacturerURL,
-                uuid
-               );
+  if (!_schema || _schemaAddr != ip.v4() || _schemaPort != port) {
+    invalidateSchema();
+
+    String address = ip.toString();
+    for (uint8_t pass = 0; pass < 2; pass++) {
+      int len = snprintf_P(_schema, _schema ? _schemaLength + 1 : 0,
+                           _ssdp_schema_template,
+                           address.c_str(), port,
+                           deviceType,
+                           friendlyName,
+                           presentationURL,
+                           serialNumber,
+                           modelName,
+                           modelNumber,
+                           modelURL,
+                           manufacturer,
+                           manufacturerURL,
+                           uuid
+                          );
+      if (pass == 0) {
+        _schemaLength = len;
+        _schema = (char*) malloc(len + 1);
+        if (!_schema)
+          return nullptr;
+      }
+    }
+    _schemaAddr = ip.v4();
+    _schemaPort = port;
+    _schemaETag = crc32(_schema, _schemaLength);
+  }
+
+  *length = _schemaLength;
+  if (etag)
+    *etag = _schemaETag;
+  return _schema;
+}
+
+void SSDPClass::schema(Print &client) {
+  size_t length;
+  const char* document = schemaDocument(&length);
+  if (!document)
+    return;
+  client.printf_P(_ssdp_schema_header, length);
+  client.write(document, length);
 }
 
 void SSDPClass::_update() {
-  if (!_pending && _server->next()) {
-    ssdp_method_t method = NONE;
-
-    _respondToAddr = _server->getRemoteAddress();
-    _respondToPort = _server->getRemotePort();
-
-    typedef enum {METHOD, URI, PROTO, KEY, VALUE, ABORT} states;
-    states state = METHOD;
-
-    typedef enum {START, MAN, ST, MX} headers;
-    headers header = START;
-
-    uint8_t cursor = 0;
-    uint8_t cr = 0;
-
-    char buffer[SSDP_BUFFER_SIZE] = {0};
-
-    while (_server->getSize() > 0) {
-      char c = _server->read();
-
-      cr = (c == '\r' || c == '\n') ? cr + 1 : 0;
-
-      switch (state) {
-        case METHOD:
-          if (c == ' ') {
-            if (strcmp(buffer, "M-SEARCH") == 0) method = SEARCH;
-
-            state = method == NONE ? ABORT : URI;
-            cursor = 0;
-
-          } else if (cursor < SSDP_METHOD_SIZE - 1) {
-            buffer[cursor++] = c;
-            buffer[cursor] = '\0';
-          }
-          break;
-        case URI:
-          if (c == ' ') {
-            state = strcmp(buffer, "*") ? ABORT : PROTO;
-            cursor = 0;
-          } else if (cursor < SSDP_URI_SIZE - 1) {
-            buffer[cursor++] = c;
-            buffer[cursor] = '\0';
-          }
-          break;
-        case PROTO:
-          if (cr == 2) {
-            state = KEY;
-            cursor = 0;
-          }
-          break;
-        case KEY:
-          if (cr == 4) {
-            _pending = true;
-            _process_time = millis();
-          }
-          else if (c == ' ') {
-            cursor = 0;
-            state = VALUE;
-          }
-          else if (c != '\r' && c != '\n' && c != ':' && cursor < SSDP_BUFFER_SIZE - 1) {
-            buffer[cursor++] = c;
-            buffer[cursor] = '\0';
-          }
-          break;
-        case VALUE:
-          if (cr == 2) {
-            switch (header) {
-              case START:
-                break;
-              case MAN:
+  char buffer[SSDP_PACKET_SIZE];
+  char type[SSDP_DEVICE_TYPE_SIZE];
+  SSDPSearch search;
+  // The parser reads byte-wise, which flash does not support
+  strncpy_P(type, deviceType, sizeof(type) - 1);
+  type[sizeof(type) - 1] = '\0';
+  while (_server->next()) {
+    // UdpContext does not expose the pbuf payload, one bulk read is the closest to parsing it in place
+    size_t length = _server->read(buffer, sizeof(buffer));
+    if (!parseSSDPSearch(buffer, length, type, uuid, &search)) {
 #ifdef DEBUG_SSDP
-                DEBUG_SSDP.printf("MAN: %s\n", (char *)buffer);
+      DEBUG_SSDP.println("SSDP ignored packet");
 #endif
-                break;
-              case ST:
-                if (strcmp(buffer, "ssdp:all")) {
-                  state = ABORT;
-#ifdef DEBUG_SSDP
-                  DEBUG_SSDP.printf("REJECT: %s\n", (char *)buffer);
-#endif
-                }else{
-                  _st_is_uuid = false;
-                }
-                // if the search type matches our type, we should respond instead of ABORT
-                if (strcasecmp(buffer, deviceType) == 0) {
-                  _pending = true;
-                  _st_is_uuid = false;
-                  _process_time = millis();
-                  state = KEY;
-                }
-                if (strcasecmp(buffer, uuid) == 0) {
-                  _pending = true;
-                  _st_is_uuid = true;
-                  _process_time = millis();
-                  state = KEY;
-                }
-                break;
-              case MX:
-                _delay = random(0, atoi(buffer)) * 1000L;
-                break;
-            }
-
-            if (state != ABORT) {
-              state = KEY;
-              header = START;
-              cursor = 0;
-            }
-          } else if (c != '\r' && c != '\n') {
-            if (header == START) {
-              if (strncmp(buffer, "MA", 2) == 0) header = MAN;
-              else if (strcmp(buffer, "ST") == 0) header = ST;
-              else if (strcmp(buffer, "MX") == 0) header = MX;
-            }
-
-            if (cursor < SSDP_BUFFER_SIZE - 1) {
-              buffer[cursor++] = c;
-              buffer[cursor] = '\0';
-            }
-          }
-          break;
-        case ABORT:
-          _pending = false; _delay = 0;
-          break;
-      }
+      continue;
     }
+    unsigned long responseDelay = search.mx > 0 ? random(0, search.mx * 1000L) : 0;
+    _enqueue(_server->getRemoteAddress(), _server->getRemotePort(), search.match == SSDP_SEARCH_UUID, responseDelay);
+  }
+
+  // Responses go out in deadline order, several may be due at once
+  SSDPResponse* response;
+  while ((response = _nextDue()) != nullptr) {
+    _send(response->stIsUuid ? SSDP_PACKET_RESPONSE_UUID : SSDP_PACKET_RESPONSE, response);
+    response->port = 0;
   }
 
-  if (_pending && (millis() - _process_time) > _delay) {
-    _pending = false; _delay = 0;
-    _send(NONE);
-  } else if(_notify_time == 0 || (millis() - _notify_time) > (interval * 1000L)){
+  if(_notify_time == 0 || (millis() - _notify_time) >= _notifyPeriod()){
     _notify_time = millis();
-    _st_is_uuid = false;
-    _send(NOTIFY);
+    if (_burst > 0) _burst--;
+    _send(SSDP_PACKET_NOTIFY);
+    if (_packets[SSDP_PACKET_NOTIFY]) _announcedAddr = _packetAddr;
   }
 
-  if (_pending) {
-    while (_server->next())
-      _server->flush();
+  _scheduleTimer();
+}
+
+// Requests from a requester that is still waiting for its response are
+// coalesced into the pending entry, a full queue drops the request
+void SSDPClass::_enqueue(const IPAddress& addr, uint16_t port, bool stIsUuid, unsigned long delay) {
+  SSDPResponse* slot = nullptr;
+  for (uint8_t i = 0; i < SSDP_QUEUE_SIZE; i++) {
+    SSDPResponse* response = &_queue[i];
+    if (response->port == 0) {
+      if (!slot) slot = response;
+    } else if (response->addr == addr && response->port == port) {
+      return;
+    }
+  }
+  if (!slot) {
+#ifdef DEBUG_SSDP
+    DEBUG_SSDP.println("SSDP queue full");
+#endif
+    return;
   }
+  slot->addr = addr;
+  slot->port = port;
+  slot->stIsUuid = stIsUuid;
+  slot->deadline = millis() + delay;
+}
 
+SSDPClass::SSDPResponse* SSDPClass::_nextDue() {
+  SSDPResponse* next = nullptr;
+  unsigned long now = millis();
+  for (uint8_t i = 0; i < SSDP_QUEUE_SIZE; i++) {
+    SSDPResponse* response = &_queue[i];
+    if (response->port == 0 || (long) (now - response->deadline) < 0) continue;
+    if (!next || (long) (response->deadline - next->deadline) < 0) next = response;
+  }
+  return next;
 }
 
+
 void SSDPClass::_onTimerStatic(SSDPClass* self) {
   self->_update();
 }
@@ -435,10 +473,38 @@ void SSDPClass::_startTimer() {
   _stopTimer();
   _timer = new SSDPTimer();
   ETSTimer* tm = &(_timer->timer);
-  const int interval = 1000;
   os_timer_disarm(tm);
   os_timer_setfn(tm, reinterpret_cast<ETSTimerFunc*>(&SSDPClass::_onTimerStatic), reinterpret_cast<void*>(this));
-  os_timer_arm(tm, interval, 1 /* repeat */);
+  _scheduleTimer();
+}
+
+// The timer only fires for the next queued response or the next NOTIFY,
+// received packets are handled right away by the onRx callback
+void SSDPClass::_scheduleTimer() {
+  if(!_timer)
+    return;
+
+  unsigned long now = millis();
+  unsigned long wait = 0;
+  if (_notify_time != 0) {
+    long remaining = (long) (_notify_time + _notifyPeriod() - now);
+    wait = remaining > 0 ? remaining : 0;
+  }
+  for (uint8_t i = 0; i < SSDP_QUEUE_SIZE; i++) {
+    if (_queue[i].port == 0) continue;
+    long remaining = (long) (_queue[i].deadline - now);
+    if (remaining < (long) wait) wait = remaining > 0 ? remaining : 0;
+  }
+
+  ETSTimer* tm = &(_timer->timer);
+  os_timer_disarm(tm);
+  os_timer_arm(tm, wait, 0 /* once */);
+}
+
+// NOTIFY is repeated a few times after begin() since multicast is lossy,
+// then falls back to the regular interval
+unsigned long SSDPClass::_notifyPeriod() {
+  return _burst > 0 ? SSDP_BURST_INTERVAL : interval * 1000L;
 }
 
 void SSDPClass::_stopTimer() {
@@ -36,25 +36,23 @@ License (MIT license):
 class UdpContext;
 
 #define SSDP_UUID_SIZE              42
-#define SSDP_SCHEMA_URL_SIZE        64
 #define SSDP_DEVICE_TYPE_SIZE       64
 #define SSDP_FRIENDLY_NAME_SIZE     64
 #define SSDP_SERIAL_NUMBER_SIZE     37
-#define SSDP_PRESENTATION_URL_SIZE  128
-#define SSDP_MODEL_NAME_SIZE        64
-#define SSDP_MODEL_URL_SIZE         128
-#define SSDP_MODEL_VERSION_SIZE     32
-#define SSDP_MANUFACTURER_SIZE      64
-#define SSDP_MANUFACTURER_URL_SIZE  128
 #define SSDP_INTERVAL_SECONDS       1200
 #define SSDP_MULTICAST_TTL          2
 #define SSDP_HTTP_PORT              80
+#define SSDP_QUEUE_SIZE             8
+#define SSDP_BURST_COUNT            3
+#define SSDP_BURST_INTERVAL         1000
 
 typedef enum {
-  NONE,
-  SEARCH,
-  NOTIFY
-} ssdp_method_t;
+  SSDP_PACKET_NOTIFY,
+  SSDP_PACKET_RESPONSE,
+  SSDP_PACKET_RESPONSE_UUID,
+  SSDP_PACKET_BYEBYE,
+  SSDP_PACKET_COUNT
+} ssdp_packet_t;
 
 
 struct SSDPTimer;
@@ -65,43 +63,69 @@ class SSDPClass{
     ~SSDPClass();
     bool begin();
     void end();
-    void schema(WiFiClient client) const { schema((Print&)std::ref(client)); }
-    void schema(Print &print) const;
+    void schema(WiFiClient client) { schema((Print&)std::ref(client)); }
+    void schema(Print &print);
+    const char* schemaDocument(size_t* length, uint32_t* etag = nullptr);
+    void invalidate();
+    void invalidateSchema();
 
     uint16_t port = SSDP_HTTP_PORT;
     uint8_t ttl = SSDP_MULTICAST_TTL;
     uint32_t interval = SSDP_INTERVAL_SECONDS;
 
-    char schemaURL[SSDP_SCHEMA_URL_SIZE];
+    // Fields that never change at runtime point to PROGMEM strings
+    PGM_P schemaURL;
+    PGM_P deviceType;
+    PGM_P presentationURL;
+    PGM_P manufacturer;
+    PGM_P manufacturerURL;
+    PGM_P modelName;
+    PGM_P modelURL;
+    PGM_P modelNumber;
+
     char uuid[SSDP_UUID_SIZE];
-    char deviceType[SSDP_DEVICE_TYPE_SIZE];
     char friendlyName[SSDP_FRIENDLY_NAME_SIZE];
     char serialNumber[SSDP_SERIAL_NUMBER_SIZE];
-    char presentationURL[SSDP_PRESENTATION_URL_SIZE];
-    char manufacturer[SSDP_MANUFACTURER_SIZE];
-    char manufacturerURL[SSDP_MANUFACTURER_URL_SIZE];
-    char modelName[SSDP_MODEL_NAME_SIZE];
-    char modelURL[SSDP_MODEL_URL_SIZE];
-    char modelNumber[SSDP_MODEL_VERSION_SIZE];
 
   protected:
-    void _send(ssdp_method_t method);
+    struct SSDPResponse {
+      IPAddress addr;
+      uint16_t port; // 0 marks a free entry
+      bool stIsUuid;
+      unsigned long deadline;
+    };
+
+    void _send(ssdp_packet_t packet, const SSDPResponse* response = nullptr);
+    void _stop(bool byebye);
+    void _enqueue(const IPAddress& addr, uint16_t port, bool stIsUuid, unsigned long delay);
+    SSDPResponse* _nextDue();
+    bool _preparePackets();
+    void _invalidatePackets();
     void _update();
     void _startTimer();
+    void _scheduleTimer();
+    unsigned long _notifyPeriod();
     void _stopTimer();
     static void _onTimerStatic(SSDPClass* self);
 
     UdpContext* _server = nullptr;
     SSDPTimer* _timer = nullptr;
 
-    IPAddress _respondToAddr;
-    uint16_t  _respondToPort = 0;
-
-    bool _pending = false;
-    bool _st_is_uuid = false;
-    unsigned short _delay = 0;
-    unsigned long _process_time = 0;
+    uint32_t _announcedAddr = 0;
     unsigned long _notify_time = 0;
+    uint8_t _burst = 0;
+    SSDPResponse _queue[SSDP_QUEUE_SIZE];
+
+    char* _packets[SSDP_PACKET_COUNT] = {};
+    uint16_t _packetLengths[SSDP_PACKET_COUNT] = {};
+    uint32_t _packetAddr = 0;
+    uint16_t _packetPort = 0;
+
+    char* _schema = nullptr;
+    uint16_t _schemaLength = 0;
+    uint32_t _schemaAddr = 0;
+    uint16_t _schemaPort = 0;
+    uint32_t _schemaETag = 0;
 };
 
 #if !defined(NO_GLOBAL_INSTANCES) && !defined(NO_GLOBAL_SSDP)
@@ -0,0 +1,127 @@
+/*
+ESP8266 Simple Service Discovery
+Copyright (c) 2015 Hristo Gochkov
+
+Original (Arduino) version by Filippo Sallemi, July 23, 2014.
+Can be found at: https://github.com/nomadnt/uSSDP
+
+License (MIT license):
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in
+  all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+  THE SOFTWARE.
+
+*/
+#include "Mod_ESP8266SSDPParser.h"
+
+#include <string.h>
+#include <strings.h>
+
+static const char _ssdp_search_line[] = "M-SEARCH * HTTP/1.";
+
+static bool _equals(const char* value, size_t length, const char* expected) {
+  return strlen(expected) == length && strncasecmp(value, expected, length) == 0;
+}
+
+static bool _isSpace(char c) {
+  return c == ' ' || c == '\t';
+}
+
+static void _trim(const char** value, size_t* length) {
+  while (*length > 0 && _isSpace(**value)) {
+    (*value)++;
+    (*length)--;
+  }
+  while (*length > 0 && _isSpace((*value)[*length - 1])) (*length)--;
+}
+
+static const char* _lastColon(const char* value, size_t length) {
+  while (length > 0) {
+    if (value[--length] == ':') return value + length;
+  }
+  return NULL;
+}
+
+// Returns -1 for anything that is not a plain decimal number, larger values
+// saturate at max so any number of digits is accepted
+static long _parseNumber(const char* value, size_t length, long max) {
+  if (length == 0) return -1;
+  long number = 0;
+  for (size_t i = 0; i < length; i++) {
+    if (value[i] < '0' || value[i] > '9') return -1;
+    if (number < max) number = number * 10 + (value[i] - '0');
+  }
+  return number > max ? max : number;
+}
+
+// urn:domain:device:type:version also matches requests for lower versions
+static bool _matchesDeviceType(const char* st, size_t length, const char* deviceType) {
+  if (_equals(st, length, deviceType)) return true;
+  if (length < 4 || strncasecmp(st, "urn:", 4) != 0) return false;
+  size_t deviceTypeLength = strlen(deviceType);
+  const char* stColon = _lastColon(st, length);
+  const char* ownColon = _lastColon(deviceType, deviceTypeLength);
+  if (!stColon || !ownColon || stColon - st != ownColon - deviceType) return false;
+  if (strncasecmp(st, deviceType, stColon - st) != 0) return false;
+  long requested = _parseNumber(stColon + 1, st + length - stColon - 1, UINT16_MAX);
+  long own = _parseNumber(ownColon + 1, deviceType + deviceTypeLength - ownColon - 1, UINT16_MAX);
+  return requested >= 1 && own >= requested;
+}
+
+bool parseSSDPSearch(const char* data, size_t length, const char* deviceType, const char* uuid, SSDPSearch* result) {
+  result->match = SSDP_SEARCH_IGNORE;
+  result->mx = 0;
+
+  size_t searchLineLength = sizeof(_ssdp_search_line) - 1;
+  if (length < searchLineLength || memcmp(data, _ssdp_search_line, searchLineLength) != 0) return false;
+
+  const char* end = data + length;
+  const char* line = (const char*) memchr(data, '\n', length);
+  bool discover = false;
+  while (line && ++line < end) {
+    const char* lineEnd = (const char*) memchr(line, '\n', end - line);
+    size_t lineLength = (lineEnd ? lineEnd : end) - line;
+    if (lineLength > 0 && line[lineLength - 1] == '\r') lineLength--;
+    if (lineLength == 0) break;
+
+    const char* colon = (const char*) memchr(line, ':', lineLength);
+    if (colon) {
+      const char* name = line;
+      size_t nameLength = colon - line;
+      const char* value = colon + 1;
+      size_t valueLength = line + lineLength - value;
+      _trim(&name, &nameLength);
+      _trim(&value, &valueLength);
+
+      if (_equals(name, nameLength, "MAN")) {
+        discover = _equals(value, valueLength, "\"ssdp:discover\"");
+      } else if (_equals(name, nameLength, "ST")) {
+        if (_equals(value, valueLength, "ssdp:all")) result->match = SSDP_SEARCH_ALL;
+        else if (_equals(value, valueLength, uuid)) result->match = SSDP_SEARCH_UUID;
+        else if (_matchesDeviceType(value, valueLength, deviceType)) result->match = SSDP_SEARCH_DEVICE_TYPE;
+        else result->match = SSDP_SEARCH_IGNORE;
+      } else if (_equals(name, nameLength, "MX")) {
+        // An invalid MX invalidates the request, a missing one means a unicast search
+        long mx = _parseNumber(value, valueLength, SSDP_MX_MAX);
+        if (mx < 0) return false;
+        result->mx = mx;
+      }
+    }
+    line = lineEnd;
+  }
+
+  return discover && result->match != SSDP_SEARCH_IGNORE;
+}
@@ -0,0 +1,54 @@
+/*
+ESP8266 Simple Service Discovery
+Copyright (c) 2015 Hristo Gochkov
+
+Original (Arduino) version by Filippo Sallemi, July 23, 2014.
+Can be found at: https://github.com/nomadnt/uSSDP
+
+License (MIT license):
+  Permission is hereby granted, free of charge, to any person obtaining a copy
+  of this software and associated documentation files (the "Software"), to deal
+  in the Software without restriction, including without limitation the rights
+  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+  copies of the Software, and to permit persons to whom the Software is
+  furnished to do so, subject to the following conditions:
+
+  The above copyright notice and this permission notice shall be included in
+  all copies or substantial portions of the Software.
+
+  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+  THE SOFTWARE.
+
+*/
+
+#ifndef ESP8266SSDPPARSER_H
+#define ESP8266SSDPPARSER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SSDP_MX_MAX 5
+
+typedef enum {
+  SSDP_SEARCH_IGNORE,
+  SSDP_SEARCH_ALL,
+  SSDP_SEARCH_DEVICE_TYPE,
+  SSDP_SEARCH_UUID
+} ssdp_search_match_t;
+
+struct SSDPSearch {
+  ssdp_search_match_t match;
+  uint8_t mx;
+};
+
+// Parses one datagram in place without copying or allocating and without
+// Arduino dependencies. Returns true for a valid M-SEARCH that this device
+// has to answer.
+bool parseSSDPSearch(const char* data, size_t length, const char* deviceType, const char* uuid, SSDPSearch* result);
+
+#endif